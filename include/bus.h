@@ -3,8 +3,91 @@
 
 #include <common.h>
 
-u8 bus_read(u16 address);
-void bus_write(u16 address, u8 value);
+// Host memory backing each 256-byte page of the address space. Pages
+// that are plain memory (ROM banks, VRAM, WRAM, cart RAM) are read and
+// written with a single indexed access, a NULL page goes through the full
+// address decode in bus_read_handler/bus_write_handler. That covers I/O,
+// OAM, echo RAM, MBC control registers and anything with side effects.
+extern u8 *bus_read_map[0x100];
+extern u8 *bus_write_map[0x100];
+
+// Dirty flag of each writable page, set on every direct write since those
+// never reach the owner's write handler
+extern u8 *bus_write_dirty[0x100];
+
+// Point size bytes starting at address (both multiples of 256) at mem,
+// NULL sends them back to the handlers. Writable pages also take the
+// flags of a dirty_map with 256 byte blocks, starting with the first page.
+void bus_map_read(u16 address, u32 size, u8 *mem);
+void bus_map_write(u16 address, u32 size, u8 *mem, u8 *dirty);
+
+// Who is holding a page, an OAM DMA owns its bus and a watchpoint has to
+// see every access
+#define BUS_HOLD_DMA (1 << 0)
+#define BUS_HOLD_WATCH (1 << 1)
+
+// Hold size bytes starting at address for owner. Until every owner has
+// called bus_release, each CPU access to them goes to the handlers, which
+// leave it to the DMA or report it to the watchpoints, while their mappings
+// are kept aside and still follow bus_map_read/write.
+void bus_hold(u16 address, u32 size, u8 owner);
+void bus_release(u8 owner);
+
+// Owners holding the page address is on, 0 if it isn't held
+u8 bus_holder(u16 address);
+
+// Memory a page really reads from, also while it is held
+u8 *bus_page(u16 address);
+
+u8 bus_read_handler(u16 address);
+u8 bus_fetch_handler(u16 address);
+u8 bus_peek_handler(u16 address);
+void bus_write_handler(u16 address, u8 value);
+
+ALWAYS_INLINE u8 bus_read(u16 address) {
+    u8 *page = bus_read_map[address >> 8];
+
+    if (page) {
+        return page[address & 0xFF];
+    }
+
+    return bus_read_handler(address);
+}
+
+// Opcode fetch, an execute watchpoint sees these instead of a read
+ALWAYS_INLINE u8 bus_fetch(u16 address) {
+    u8 *page = bus_read_map[address >> 8];
+
+    if (page) {
+        return page[address & 0xFF];
+    }
+
+    return bus_fetch_handler(address);
+}
+
+// Read on the emulator's own behalf, decoding code to translate or check
+// it, which no watchpoint is told about
+ALWAYS_INLINE u8 bus_peek(u16 address) {
+    u8 *page = bus_read_map[address >> 8];
+
+    if (page) {
+        return page[address & 0xFF];
+    }
+
+    return bus_peek_handler(address);
+}
+
+ALWAYS_INLINE void bus_write(u16 address, u8 value) {
+    u8 *page = bus_write_map[address >> 8];
+
+    if (page) {
+        page[address & 0xFF] = value;
+        *bus_write_dirty[address >> 8] = 1;
+        return;
+    }
+
+    bus_write_handler(address, value);
+}
 
 u16 bus_read16(u16 address);
 void bus_write16(u16 address, u16 value);
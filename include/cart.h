@@ -2,6 +2,7 @@
 #define __CART_H__
 
 #include <common.h>
+#include <dirty.h>
 
 // Information included in cartridge header referenced from this doc:
 // https://gbdev.io/pandocs/The_Cartridge_Header.html
@@ -23,6 +24,66 @@ typedef struct {
     u16 global_checksum;
 } rom_header;
 
+// Header fields parsed out of the ROM, which is mapped read-only
+typedef struct {
+    char title[16];             // NUL terminated, the last byte is the CGB flag on newer carts
+    u16 new_lic_code;
+    u8 type;
+    u8 rom_size;
+    u8 ram_size;
+    u8 lic_code;
+    u8 version;
+    u8 checksum;
+    bool checksum_ok;
+} cart_header;
+
+// MBC3 real time clock, counted in emulated time
+typedef struct {
+    u8 regs[5];                 // seconds, minutes, hours, day low, day high
+    u8 latched[5];              // copy the CPU reads, taken on a 0 -> 1 latch write
+    u8 latch;                   // last value written to 6000-7FFF
+    u64 tick;                   // emulator tick regs are current to
+} cart_rtc;
+
+struct _cart_mapper;
+
+typedef struct {
+    char filename[1024];
+    u32 rom_size;
+    u8 *rom_data;               // read-only, mapped from the file when possible
+    u16 rom_banks;              // number of 16 KB banks, the file is padded to a whole bank
+    cart_header header;
+
+    const struct _cart_mapper *mapper;
+
+    // Banks switched in, worked out by the mapper after every register
+    // write and mapped straight into the bus
+    u8 *rom_bank_0;             // 0000-3FFF
+    u8 *rom_bank_x;             // 4000-7FFF
+    u8 *ram_bank;               // A000-BFFF, NULL when disabled or not plain memory
+
+    // Mapper registers
+    bool ram_enabled;
+    u8 banking_mode;
+    u16 rom_bank_value;
+    u8 ram_bank_value;
+    cart_rtc rtc;
+
+    u8 *ram_data;               // all RAM banks back to back
+    u32 ram_size;
+    dirty_map ram_dirty;        // per 256 byte page of ram_data
+    dirty_view ram_saved;       // pages written since the last battery save
+
+    // Battery Data
+    bool battery;               // whether it has battery or not
+    bool battery_mapped;        // ram_data is the .battery file mapped in memory
+    int battery_fd;             // the locked .battery file, -1 until opened
+    bool battery_shared;        // another instance holds the file, nothing is saved
+    bool need_save;             // whether we should save battery backup or not
+} cart_context;
+
+cart_context *cart_get_context();
+
 bool cart_load(char *cart);
 
 u8 cart_read(u16 address);
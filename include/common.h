@@ -25,6 +25,13 @@ u32 get_ticks();
 
 void delay(u32 ms);
 
+// Forces inlining so callers with constant arguments get a specialized copy
+#if defined(_MSC_VER)
+#define ALWAYS_INLINE static __forceinline
+#else
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+#endif
+
 #define NO_IMPL { fprintf(stderr, "NOT YET IMPLEMENTED\n"); exit(-5); }
 
 #endif /* __COMMON_H__ */
@@ -4,19 +4,42 @@
 #include <common.h>
 #include <instructions.h>
 
-typedef struct {
-    u8 a;
-    u8 f;
-    u8 b;
-    u8 c;
-    u8 d;
-    u8 e;
-    u8 h;
-    u8 l;
-    u16 pc;                  // program counter
-    u16 sp;                  // stack pointer
+// Lay out each register pair so its 16-bit view is (hi << 8) | lo on the host
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_LO_FIRST 0
+#define REG_PAIR(hi, lo) union { u16 hi##lo; struct { u8 hi; u8 lo; }; }
+#else
+#define REG_LO_FIRST 1
+#define REG_PAIR(hi, lo) union { u16 hi##lo; struct { u8 lo; u8 hi; }; }
+#endif
+
+typedef union {
+    struct {
+        REG_PAIR(a, f);
+        REG_PAIR(b, c);
+        REG_PAIR(d, e);
+        REG_PAIR(h, l);
+        u16 sp;              // stack pointer
+        u16 pc;              // program counter
+    };
+    u16 r16[6];              // AF, BC, DE, HL, SP, PC, indexed by rt - RT_AF
+    u8 r8[8];                // A to L, indexed by REG8_INDEX(rt)
 } cpu_registers;
 
+// Position of an 8-bit register (RT_A to RT_L) in cpu_registers.r8
+#define REG8_INDEX(rt) (((rt) - RT_A) ^ REG_LO_FIRST)
+
+// Flag-setting operation recorded in place of computing F, see cpu_flags_sync()
+typedef enum {
+    LF_NONE,                 // F is up to date
+    LF_ADD,                  // ADD/ADC, flag_c is the carry in
+    LF_SUB,                  // SUB/SBC/CP, flag_c is the carry in
+    LF_AND,
+    LF_OR,                   // OR and XOR
+    LF_INC,                  // 8-bit INC, flag_c is the carry left unchanged
+    LF_DEC                   // 8-bit DEC, flag_c is the carry left unchanged
+} lazy_flag_op;
+
 typedef struct {
     cpu_registers regs;
     u16 fetched_data;        // currently fetched data
@@ -33,12 +56,40 @@ typedef struct {
     u8 ie_register;          // interrupt enable register
     u8 int_flags;
 
+    // Last 8-bit ALU operation, F's upper nibble is only computed from
+    // these when something reads it
+    u8 flag_op;              // lazy_flag_op
+    u8 flag_a;               // first operand
+    u8 flag_b;               // second operand
+    u8 flag_c;               // carry in, or the carry INC/DEC keep
+    u8 flag_r;               // 8-bit result
+
 } cpu_context;
 
+// Sets debug mode on or off
+#define CPU_DEBUG 0
+
+// Run the CPU in batches through the threaded interpreter loop, set at
+// build time with the GBEMU_THREADED_CPU CMake option
+#ifndef CPU_THREADED
+#define CPU_THREADED 0
+#endif
+
+// Run ROM and RAM code through the x86-64 block recompiler in jit.c, set
+// at build time with the GBEMU_JIT CMake option
+#ifndef CPU_JIT
+#define CPU_JIT 0
+#endif
+
+// Instructions per cpu_run_batch() call, bounds how long the emulator
+// thread goes without checking the paused/running flags
+#define CPU_BATCH_STEPS 4096
+
 cpu_registers *cpu_get_regs();
 
 void cpu_init();
 bool cpu_step();
+bool cpu_run_batch(u32 max_steps);
 
 u16 cpu_read_reg(reg_type rt);
 void cpu_set_reg(reg_type rt, u16 val);
@@ -46,21 +97,95 @@ void cpu_set_reg(reg_type rt, u16 val);
 u8 cpu_read_reg8(reg_type rt);
 void cpu_set_reg8(reg_type rt, u8 val);
 
-typedef void (*IN_PROC)(cpu_context *);
+// Register access used by the instruction processors, every register is a
+// single indexed load or store and a constant type folds to a fixed field
+ALWAYS_INLINE u16 cpu_regs_read(cpu_registers *regs, reg_type rt) {
+    if (rt == RT_NONE) {
+        return 0;
+    }
 
-IN_PROC inst_get_processor(in_type type);
+    if (rt < RT_AF) {
+        return regs->r8[REG8_INDEX(rt)];
+    }
 
-#define CPU_FLAG_Z BIT(ctx->regs.f, 7)
-#define CPU_FLAG_C BIT(ctx->regs.f, 4)
+    return regs->r16[rt - RT_AF];
+}
 
-typedef void (*IN_PROC)(cpu_context *);
+ALWAYS_INLINE void cpu_regs_set(cpu_registers *regs, reg_type rt, u16 val) {
+    if (rt == RT_NONE) {
+        return;
+    }
 
-IN_PROC inst_get_processor(in_type type);
+    if (rt < RT_AF) {
+        regs->r8[REG8_INDEX(rt)] = val & 0xFF;
+        return;
+    }
 
-#define CPU_FLAG_Z BIT(ctx->regs.f, 7)
-#define CPU_FLAG_N BIT(ctx->regs.f, 6)
-#define CPU_FLAG_H BIT(ctx->regs.f, 5)
-#define CPU_FLAG_C BIT(ctx->regs.f, 4)
+    regs->r16[rt - RT_AF] = val;
+}
+
+typedef void (*IN_PROC)(cpu_context *);
+
+// Specialized processor for every opcode, each one fetches its own operands
+// and executes with the instruction's registers and condition baked in
+extern IN_PROC inst_processors[0x100];
+
+u32 cpu_exec_batch(cpu_context *ctx, u32 max_steps);
+
+// Service interrupts and finish enabling IME once an instruction completes,
+// shared by cpu_step and the batch loops
+void cpu_complete_step(cpu_context *ctx);
+
+// Compute F from the recorded ALU operation, if there is one
+void cpu_flags_sync(cpu_context *ctx);
+
+// Record an 8-bit ALU operation instead of setting Z/N/H/C
+ALWAYS_INLINE void cpu_defer_flags(cpu_context *ctx, lazy_flag_op op, u8 a, u8 b, u8 c, u8 r) {
+    ctx->flag_op = op;
+    ctx->flag_a = a;
+    ctx->flag_b = b;
+    ctx->flag_c = c;
+    ctx->flag_r = r;
+}
+
+// Up to date F register
+ALWAYS_INLINE u8 cpu_flags(cpu_context *ctx) {
+    if (ctx->flag_op != LF_NONE) {
+        cpu_flags_sync(ctx);
+    }
+
+    return ctx->regs.f;
+}
+
+// Z and C are what conditional jumps test, so both are answered straight
+// from a recorded operation without computing the rest of F
+ALWAYS_INLINE bool cpu_flag_z(cpu_context *ctx) {
+    if (ctx->flag_op != LF_NONE) {
+        return ctx->flag_r == 0;
+    }
+
+    return BIT(ctx->regs.f, 7);
+}
+
+ALWAYS_INLINE bool cpu_flag_c(cpu_context *ctx) {
+    int a = ctx->flag_a;
+    int b = ctx->flag_b;
+    int c = ctx->flag_c;
+
+    switch(ctx->flag_op) {
+        case LF_NONE: return BIT(ctx->regs.f, 4);
+        case LF_ADD: return a + b + c > 0xFF;
+        case LF_SUB: return a - b - c < 0;
+        case LF_INC:
+        case LF_DEC: return c;
+        default: return 0;
+    }
+}
+
+#define CPU_FLAG_Z cpu_flag_z(ctx)
+#define CPU_FLAG_N BIT(cpu_flags(ctx), 6)
+#define CPU_FLAG_H BIT(cpu_flags(ctx), 5)
+#define CPU_FLAG_C cpu_flag_c(ctx)
 
 u8 cpu_get_ie_register();
 void cpu_set_ie_register(u8 n);
@@ -70,4 +195,6 @@ void cpu_set_int_flags(u8 value);
 
 void inst_to_str(cpu_context *ctx, char *str);
 
+void cpu_debug_trace(cpu_context *ctx);
+
 #endif /* __CPU_H__ */
@@ -0,0 +1,201 @@
+#ifndef __CPU_FETCH_H__
+#define __CPU_FETCH_H__
+
+#include <cpu.h>
+#include <bus.h>
+#include <emu.h>
+
+// Returns true if the addressing mode writes its result to memory
+ALWAYS_INLINE bool mode_dest_is_mem(addr_mode mode) {
+    switch(mode) {
+        case AM_MR_R:
+        case AM_HLI_R:
+        case AM_HLD_R:
+        case AM_A8_R:
+        case AM_A16_R:
+        case AM_D16_R:
+        case AM_MR_D8:
+        case AM_MR:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Fetch operands for an instruction, inlined into each opcode's processor
+// so the addressing mode and registers are resolved at compile time
+ALWAYS_INLINE void fetch_data(cpu_context *ctx, const instruction *inst) {
+    ctx->mem_dest = 0;
+    ctx->dest_is_mem = mode_dest_is_mem(inst->mode);
+
+    switch(inst->mode) {
+        case AM_IMP:
+            return;
+
+        // Read data from register 1
+        case AM_R:
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_1);
+            return;
+
+        // Read data from register 2
+        case AM_R_R:
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_2);
+            return;
+
+        // Read data from 8-bit value
+        case AM_R_D8:
+            ctx->fetched_data = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+            ctx->regs.pc++;
+            return;
+
+        // Read data from 16-bit value
+        case AM_R_D16:
+        case AM_D16: {
+            u16 lo = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+
+            u16 hi = bus_read(ctx->regs.pc + 1);
+            emu_cycles(1);
+
+            ctx->fetched_data = lo | (hi << 8);
+            ctx->regs.pc += 2;
+            return;
+        }
+
+        // Load register into a memory region
+        case AM_MR_R:
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_2);
+            ctx->mem_dest = cpu_regs_read(&ctx->regs, inst->reg_1);
+
+            // instruction LDH C, (A)
+            if (inst->reg_1 == RT_C) { // carry flag register
+                ctx->mem_dest |= 0xFF00; // write to C the MSO of 0xFF00
+            }
+
+            return;
+
+        // Load memory region into a register
+        case AM_R_MR: {
+            u16 addr = cpu_regs_read(&ctx->regs, inst->reg_2);
+
+            if (inst->reg_2 == RT_C) { // carry flag register
+                addr |= 0xFF00; // write to C the MSO of 0xFF00
+            }
+
+            ctx->fetched_data = bus_read(addr);
+            emu_cycles(1);
+            return;
+        }
+
+        // Loading address of HL register then increment by 1
+        case AM_R_HLI:
+            ctx->fetched_data = bus_read(cpu_regs_read(&ctx->regs, inst->reg_2));
+            emu_cycles(1);
+            cpu_regs_set(&ctx->regs, RT_HL, cpu_regs_read(&ctx->regs, RT_HL) + 1);
+            return;
+
+        // Loading address of HL register then decrement by 1
+        case AM_R_HLD:
+            ctx->fetched_data = bus_read(cpu_regs_read(&ctx->regs, inst->reg_2));
+            emu_cycles(1);
+            cpu_regs_set(&ctx->regs, RT_HL, cpu_regs_read(&ctx->regs, RT_HL) - 1);
+            return;
+
+        // Load register value into HL register, then increment HL by 1
+        case AM_HLI_R:
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_2);
+            ctx->mem_dest = cpu_regs_read(&ctx->regs, inst->reg_1);
+            cpu_regs_set(&ctx->regs, RT_HL, cpu_regs_read(&ctx->regs, RT_HL) + 1);
+            return;
+
+        // Load register value into HL register, , then decrement HL by 1
+        case AM_HLD_R:
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_2);
+            ctx->mem_dest = cpu_regs_read(&ctx->regs, inst->reg_1);
+            cpu_regs_set(&ctx->regs, RT_HL, cpu_regs_read(&ctx->regs, RT_HL) - 1);
+            return;
+
+        // Move A8 into register
+        case AM_R_A8:
+            ctx->fetched_data = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+            ctx->regs.pc++;
+            return;
+
+        // Move register into A8
+        case AM_A8_R:
+            ctx->mem_dest = bus_read(ctx->regs.pc) | 0xFF00;
+            emu_cycles(1);
+            ctx->regs.pc++;
+            return;
+
+        // Special case - Load HL and SP, increment by r8
+        case AM_HL_SPR:
+            ctx->fetched_data = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+            ctx->regs.pc++;
+            return;
+
+        // Read data from 8-bit value
+        case AM_D8:
+            ctx->fetched_data = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+            ctx->regs.pc++;
+            return;
+
+        // Loading register into a 16 bit address
+        case AM_A16_R:
+        case AM_D16_R: {
+            u16 lo = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+
+            u16 hi = bus_read(ctx->regs.pc + 1);
+            emu_cycles(1);
+
+            ctx->mem_dest = lo | (hi << 8);
+
+            ctx->regs.pc += 2;
+            ctx->fetched_data = cpu_regs_read(&ctx->regs, inst->reg_2);
+            return;
+        }
+
+        // Load D8 into memory register
+        case AM_MR_D8:
+            ctx->fetched_data = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+            ctx->regs.pc++;
+            ctx->mem_dest = cpu_regs_read(&ctx->regs, inst->reg_1);
+            return;
+
+        // Load into memory register
+        case AM_MR:
+            ctx->mem_dest = cpu_regs_read(&ctx->regs, inst->reg_1);
+            ctx->fetched_data = bus_read(cpu_regs_read(&ctx->regs, inst->reg_1));
+            emu_cycles(1);
+            return;
+
+        case AM_R_A16: {
+            u16 lo = bus_read(ctx->regs.pc);
+            emu_cycles(1);
+
+            u16 hi = bus_read(ctx->regs.pc + 1);
+            emu_cycles(1);
+
+            u16 addr = lo | (hi << 8);
+
+            ctx->regs.pc += 2;
+            ctx->fetched_data = bus_read(addr);
+            emu_cycles(1);
+            return;
+        }
+
+        default:
+            printf("Unknown Addressing Mode! %d (%02X)\n", inst->mode, ctx->cur_opcode);
+            exit(-7);
+            return;
+    }
+}
+
+#endif /* __CPU_FETCH_H__ */
@@ -4,7 +4,7 @@
 #include <common.h>
 #include <cpu.h>
 
-void dbg_update();
+void dbg_init();
 void dbg_print();
 
 #endif /* __DBG_H__ */
@@ -0,0 +1,63 @@
+#ifndef __DIRTY_H__
+#define __DIRTY_H__
+
+#include <common.h>
+#include <string.h>
+
+/*
+    Dirty tracking
+
+    Memory is split into fixed size blocks, each with a flag the write
+    paths set. Flags are whole bytes rather than bits so marking is a
+    single store, and any number of writes to a block between two looks
+    cost the same.
+
+    Every consumer (so far the debug tile view and battery saves) looks
+    through a dirty_view of its own, so one of them taking a change doesn't
+    hide it from the others. A look folds the flags into a generation per
+    block, bumped on every change, and each view keeps the generation it
+    last saw of every block.
+*/
+
+typedef struct {
+    u8 *blocks;             // one flag per block, set by the write paths
+    u32 *gens;              // generation of each block, as of the last fold
+    u32 gen;                // last generation handed out, bumped atomically
+    u32 count;              // number of blocks
+    u8 shift;               // log2 of the block size in bytes
+} dirty_map;
+
+typedef struct {
+    dirty_map *map;
+    u32 *seen;              // generation of each block at this view's last take
+    u32 count;
+} dirty_view;
+
+// Track size bytes in blocks of 1 << shift bytes, all of them start dirty
+// since nobody has seen them yet
+void dirty_init(dirty_map *map, u32 size, u8 shift);
+
+ALWAYS_INLINE void dirty_mark(dirty_map *map, u32 offset) {
+    map->blocks[offset >> map->shift] = 1;
+}
+
+// Every block, for writes that replace all of the memory at once
+ALWAYS_INLINE void dirty_mark_all(dirty_map *map) {
+    memset(map->blocks, 1, map->count);
+}
+
+// Whether dirty_init has set map up, safe to ask from another thread
+bool dirty_ready(dirty_map *map);
+
+// Look at map through view. Every block starts dirty for a new view, and
+// again whenever dirty_init resizes the map.
+void dirty_view_init(dirty_view *view, dirty_map *map);
+
+// Returns whether the block changed since this view last took it
+bool dirty_take(dirty_view *view, u32 block);
+
+// Copies whether each block changed since this view last took it to out,
+// returns the number of blocks that changed
+u32 dirty_take_all(dirty_view *view, u8 *out);
+
+#endif /* __DIRTY_H__ */
@@ -4,7 +4,10 @@
 #include <common.h>
 
 void dma_start(u8 start);
-void dma_tick();
+void dma_event(u64 when);
+
+// Value the CPU reads from a bus page held by the transfer
+u8 dma_conflict_read(u16 address);
 
 bool dma_transferring();
 
@@ -16,4 +16,7 @@ emu_context *emu_get_context();
 
 void emu_cycles(int cpu_cycles);
 
+u32 emu_quiet_cycles();
+void emu_skip_cycles(u32 cpu_cycles);
+
 #endif /* __EMU_H__ */
@@ -0,0 +1,37 @@
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include <common.h>
+#include <cpu.h>
+
+/*
+    Idle loop skipping
+
+    Games often wait for VBlank or an interrupt handler by spinning on a
+    short loop that reads a register or a RAM flag, e.g.
+
+        wait: ldh a, ($44)
+              cp $90
+              jr nz, wait
+
+    When such a loop only reads memory that can't change until the next
+    timer, PPU or DMA event and every pass leaves the registers exactly as
+    it found them, the passes up to that event are skipped in one step.
+*/
+
+// Longest loop body, in bytes, checked for side effects
+#define IDLE_MAX_LOOP_BYTES 16
+
+typedef struct {
+    u64 loops_detected;   // side-effect free loops seen
+    u64 loops_skipped;    // times a loop was fast-forwarded
+    u64 cycles_skipped;   // M-cycles skipped
+} idle_stats;
+
+// Called by JP/JR after a taken jump backwards to ctx->regs.pc, from is
+// the address just past the jump instruction
+void idle_loop(cpu_context *ctx, u16 from);
+
+idle_stats *idle_get_stats();
+
+#endif /* __IDLE_H__ */
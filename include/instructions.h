@@ -126,6 +126,8 @@ typedef struct {
 
 instruction *instruction_by_opcode(u8 opcode);
 
+u16 inst_length(addr_mode mode);
+
 char *inst_name(in_type t);
 
 #endif /* __INSTRUCTIONS_H__ */
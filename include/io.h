@@ -6,4 +6,15 @@
 u8 io_read(u16 address);
 void io_write(u16 address, u8 value);
 
+// Reads and writes of registers that don't exist
+u64 io_unmapped_accesses();
+
+void serial_event(u64 when);
+
+// Called with each byte the CPU starts shifting out on the internal clock,
+// which is how test ROMs print their results
+typedef void (*serial_callback)(u8 value);
+
+void serial_set_callback(serial_callback callback);
+
 #endif /* __IO_H__ */
@@ -0,0 +1,56 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <common.h>
+#include <cpu.h>
+
+/*
+    Dynamic recompiler for straight-line SM83 code on x86-64 Linux
+
+    Blocks are translated from ROM, WRAM and HRAM the first time they run.
+    Register only instructions are emitted as native code, everything else
+    calls the opcode's specialized processor, and every instruction still
+    ticks the bus and checks for pending interrupts so timing matches the
+    interpreter exactly.
+*/
+
+// Longest run of instructions translated into a single block
+#define JIT_MAX_BLOCK_INSTS 64
+
+// Size of the executable buffer blocks are emitted into, flushed when full
+#define JIT_CODE_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+    u64 blocks_compiled;
+    u64 blocks_run;
+    u64 insts_run;
+    u64 flushes;
+    u64 ram_invalidations;
+} jit_stats;
+
+// Number of blocks translated from each WRAM and HRAM byte, indexed by
+// address - 0xC000 so the RAM write paths can check it inline
+extern u8 jit_ram_code[0x4000];
+
+void jit_init();
+
+// Run the block at the current pc, returns the number of instructions
+// executed or 0 if the address can't be compiled (VRAM, cart RAM, echo RAM)
+u32 jit_run(cpu_context *ctx);
+
+// Called by the RAM write paths when a byte covered by a block changes,
+// drops every block translated from that byte
+void jit_invalidate_ram(u16 address);
+
+// Called by the cartridge when a different ROM bank is mapped at 4000-7FFF
+void jit_map_rom_bank(u16 bank);
+
+// Called by the cartridge when a different ROM bank is mapped at 0000-3FFF
+void jit_map_rom_bank0(u16 bank);
+
+// Drop every translated block, for changes the blocks can't see coming
+void jit_flush();
+
+jit_stats *jit_get_stats();
+
+#endif /* __JIT_H__ */
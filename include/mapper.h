@@ -0,0 +1,27 @@
+#ifndef __MAPPER_H__
+#define __MAPPER_H__
+
+#include <cart.h>
+
+/*
+    Memory bank controllers
+    Reference: https://gbdev.io/pandocs/MBCs.html
+
+    The mapper is picked from the header type once in cart_load. write
+    handles the registers at 0000-7FFF and map turns them into bank
+    pointers, which the cartridge hands to the bus. ram_read/ram_write
+    only see A000-BFFF accesses when ram_bank is NULL, e.g. MBC2's
+    4-bit RAM or the MBC3 clock registers.
+*/
+
+typedef struct _cart_mapper {
+    const char *name;
+    void (*write)(cart_context *cart, u16 address, u8 value);
+    void (*map)(cart_context *cart);
+    u8 (*ram_read)(cart_context *cart, u16 address);
+    void (*ram_write)(cart_context *cart, u16 address, u8 value);
+} cart_mapper;
+
+const cart_mapper *mapper_for_type(u8 type);
+
+#endif /* __MAPPER_H__ */
@@ -2,6 +2,7 @@
 #define __PPU_H__
 
 #include <common.h>
+#include <dirty.h>
 
 static const int LINES_PER_FRAME = 154;
 static const int TICKS_PER_LINE = 456;
@@ -18,19 +19,22 @@ typedef enum {
     FS_PUSH                         // push pixels
 } fetch_state;
 
-// Single entry of FIFO pipeline
-typedef struct _fifo_entry {
-    struct _fifo_entry *next;       // pointer to next entry
-    u32 value;                      // 32 bit color value
-} fifo_entry;
+// Pixels are only added while the FIFO holds 8 or less, 8 at a time
+#define PIXEL_FIFO_SIZE 16
 
-// FIFO pipeline structure resembling a linked-list
+// FIFO pipeline structure, a ring buffer so rendering never allocates
 typedef struct {
-    fifo_entry *head;               // start of pipeline
-    fifo_entry *tail;               // end of pipeline
-    u32 size;
+    u32 values[PIXEL_FIFO_SIZE];    // 32 bit color values
+    u8 head;                        // index of the first pixel
+    u8 size;
 } fifo;
 
+// How pixel transfer draws a line
+typedef enum {
+    RENDER_FIFO,                    // pixel FIFO, dot by dot
+    RENDER_SCANLINE,                // whole line at once when the FIFO would end
+} ppu_renderer;
+
 typedef struct {
     fetch_state cur_fetch_state;    // current pixel fetch state
     fifo pixel_fifo;                // fifo pipeline structure
@@ -39,12 +43,27 @@ typedef struct {
     u8 fetch_x;                     // x coordinate of fetched pixel
     u8 bgw_fetch_data[3];           // fetched background pixels
     u8 fetch_entry_data[6];         // OAM data
+    u16 bgw_fetch_row;              // tile row the background data came from
+    u16 fetch_entry_row[3];         // tile row each sprite's data came from
+    u8 *bgw_pixels;                 // decoded background row being pushed
+    u8 *entry_pixels[3];            // decoded sprite rows being pushed, flipped if needed
+    u8 decoded[4][8];               // rows decoded from the fetched bytes
     u8 map_x;                       // x coordinate of tilemap
     u8 map_y;                       // y coordinate of tilemap
     u8 tile_y;                      // y coordinate of object tile
     u8 fifo_x;                      // x coordinate of fifo pipeline
 } pixel_fifo_context;
 
+// VRAM tile data decoded to 2-bit color indices, 8 pixels for each pair of
+// bytes. Rows are numbered by address, (address - 0x8000) / 2, so a tall
+// sprite's second tile follows on from its first.
+#define TILE_COUNT 384
+
+typedef struct {
+    u8 rows[TILE_COUNT * 8][8];     // left to right
+    u8 flipped[TILE_COUNT * 8][8];  // right to left, for X-flipped sprites
+} tile_cache;
+
 typedef struct {
     u8 y;
     u8 x;
@@ -68,37 +87,72 @@ typedef struct {
     Bit2-0 Palette number  **CGB Mode Only**     (OBP0-7)
  */
 
-typedef struct _oam_line_entry {
-    oam_entry entry;
-    struct _oam_line_entry *next;
-} oam_line_entry;
+#define LINE_SPRITES 10
+
+// Sprites on a line, as OAM indices ordered by X and then by index, which
+// is the order the fetcher looks at them in
+typedef struct {
+    u8 count;
+    u8 sprites[LINE_SPRITES];
+} sprite_bucket;
 
 typedef struct {
     oam_entry oam_ram[40];
     u8 vram[0x2000];                // video ram
+    tile_cache tiles;               // decoded tile data, follows every VRAM write
 
     pixel_fifo_context pfc;
 
     u8 line_sprite_count; // 0 to 10 sprites
-    oam_line_entry *line_sprites; // linked list of current sprites on line
-    oam_line_entry line_entry_array[10]; // memory to use for list, so we don't need to call malloc and free repeatedly
+    oam_entry line_sprites[LINE_SPRITES]; // current sprites on line, copied from OAM when it starts
+
+    // Sprites of every line, rebuilt on the first line after OAM or the
+    // sprite height changes instead of scanning OAM on each of them
+    sprite_bucket sprite_lines[144];    // one per visible line, YRES
+    bool sprite_lines_dirty;
+    u8 sprite_lines_height;
 
     u8 fetched_entry_count; // for the fifo fetching process
     oam_entry fetched_entries[3]; // entries fetched during pipeline, fetch 3 entries per section of pixels in the fifo
     u8 window_line;     // current line on the window
 
+    ppu_renderer renderer;
+    bool line_scanline; // current line is left to the scanline renderer
+    u32 line_end;       // line_ticks pixel transfer ends on, for the scanline renderer
+
     u32 current_frame;
     u32 line_ticks;
+    u64 synced_tick;    // last tick the PPU ran, it catches up from here
     u32 *video_buffer;
+
+    dirty_map vram_dirty;   // per 16 byte tile
+    dirty_map oam_dirty;    // per 4 byte entry
 } ppu_context;
 
 void ppu_init();
 void ppu_tick();
 
+void ppu_event(u64 when);
+void ppu_sync(u64 tick);
+void ppu_reschedule();
+
+// First tick STAT's mode bits may read differently than now
+u64 ppu_stat_change();
+
 void ppu_oam_write(u16 address, u8 value);
 u8 ppu_oam_read(u16 address);
 
+// Replace the whole table, for OAM DMA
+void ppu_oam_copy(const u8 *table);
+
 void ppu_vram_write(u16 address, u8 value);
+
+// Lines where anything pixel transfer reads is written mid-line always go
+// through the FIFO, ppu_xfer_write has to be called for every such write
+// once the PPU has caught up and before the value changes
+void ppu_set_renderer(ppu_renderer renderer);
+void ppu_xfer_write();
+
 u8 ppu_vram_read(u16 address);
 
 ppu_context *ppu_get_context();
@@ -106,4 +160,7 @@ ppu_context *ppu_get_context();
 void pipeline_fifo_reset();
 void pipeline_process();
 
+u32 pipeline_line_end();
+void pipeline_render_line();
+
 #endif /* __PPU_H__ */
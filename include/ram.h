@@ -2,6 +2,15 @@
 #define __RAM_H__
 
 #include <common.h>
+#include <dirty.h>
+
+// HRAM shares its page with the I/O registers so the bus can't map it,
+// the stack reaches it directly instead
+extern u8 hram[0x80];
+
+void ram_init();
+
+dirty_map *wram_get_dirty();
 
 u8 wram_read(u16 address);
 void wram_write(u16 address, u8 value);
@@ -0,0 +1,38 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <common.h>
+
+/*
+    Event scheduler
+
+    Components no longer tick every T-cycle. Each one keeps its state as of
+    the last tick it ran and registers the absolute tick of the next thing
+    it has to do, the CPU runs freely until the earliest of those.
+
+    Events due on the same tick run in the order of the enum below, which
+    matches the order the components used to be ticked in.
+*/
+
+typedef enum {
+    EV_TIMER,       // TIMA reaches 0xFF and reloads from TMA
+    EV_PPU,         // next dot the PPU does more than count
+    EV_DMA,         // next OAM DMA byte
+    EV_SERIAL,      // serial transfer complete
+    EV_COUNT
+} sched_event;
+
+// Tick of the earliest pending event, kept outside the heap so
+// emu_cycles can test it inline
+extern u64 sched_next_tick;
+
+void sched_init();
+
+// Run ev on tick when, replacing any pending run of the same event
+void sched_schedule(sched_event ev, u64 when);
+void sched_cancel(sched_event ev);
+
+// Run every event due on or before now, in tick order
+void sched_run(u64 now);
+
+#endif /* __SCHED_H__ */
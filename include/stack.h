@@ -2,6 +2,12 @@
 #define __STACK_H__
 
 #include <common.h>
+#include <cpu.h>
+#include <bus.h>
+#include <ram.h>
+#include <emu.h>
+#include <jit.h>
+#include <watch.h>
 
 void stack_push(u8 data);
 void stack_push16(u16 data);
@@ -9,4 +15,101 @@ void stack_push16(u16 data);
 u8 stack_pop();
 u16 stack_pop16();
 
+// Host memory holding the stack bytes at address and address + 1 if both
+// are plain memory, NULL if they have to go through the bus. SP nearly
+// always points into WRAM, which the bus maps directly, or HRAM, which
+// only goes through the bus while a watchpoint is on it.
+ALWAYS_INLINE u8 *stack_host_read(u16 address) {
+    if ((address & 0xFF) == 0xFF) {
+        return NULL;                        // split over two pages
+    }
+
+    u8 *page = bus_read_map[address >> 8];
+
+    if (page) {
+        return page + (address & 0xFF);
+    }
+
+    if (address >= 0xFF80 && address < 0xFFFE && !watch_pages[0xFF]) {
+        return hram + (address - 0xFF80);
+    }
+
+    return NULL;
+}
+
+// Same for writes, which also have to keep the dirty flags and leave HRAM
+// holding translated code to hram_write
+ALWAYS_INLINE u8 *stack_host_write(u16 address) {
+    if ((address & 0xFF) == 0xFF) {
+        return NULL;
+    }
+
+    u8 *page = bus_write_map[address >> 8];
+
+    if (page) {
+        *bus_write_dirty[address >> 8] = 1;
+        return page + (address & 0xFF);
+    }
+
+    if (address >= 0xFF80 && address < 0xFFFE && !watch_pages[0xFF] &&
+            !jit_ram_code[address - 0xC000] && !jit_ram_code[address - 0xC000 + 1]) {
+        return hram + (address - 0xFF80);
+    }
+
+    return NULL;
+}
+
+// Pop a 16-bit value, spending gap M-cycles after each byte. Plain memory
+// is read in one go since nothing can tell when it was read.
+ALWAYS_INLINE u16 stack_pop16_cycles(cpu_context *ctx, u8 gap) {
+    u8 *sp = stack_host_read(ctx->regs.sp);
+    u16 lo, hi;
+
+    if (sp) {
+        lo = sp[0];
+        hi = sp[1];
+        ctx->regs.sp += 2;
+
+        if (gap) {
+            emu_cycles(gap * 2);
+        }
+    } else {
+        lo = bus_read(ctx->regs.sp++);
+        if (gap) {
+            emu_cycles(gap);
+        }
+
+        hi = bus_read(ctx->regs.sp++);
+        if (gap) {
+            emu_cycles(gap);
+        }
+    }
+
+    return (hi << 8) | lo;
+}
+
+// Push a 16-bit value, high byte first, spending gap M-cycles between the
+// two writes
+ALWAYS_INLINE void stack_push16_cycles(cpu_context *ctx, u16 data, u8 gap) {
+    u8 *sp = stack_host_write(ctx->regs.sp - 2);
+
+    if (sp) {
+        sp[1] = data >> 8;
+        sp[0] = data & 0xFF;
+        ctx->regs.sp -= 2;
+
+        if (gap) {
+            emu_cycles(gap);
+        }
+        return;
+    }
+
+    bus_write(--ctx->regs.sp, data >> 8);
+    if (gap) {
+        emu_cycles(gap);
+    }
+
+    bus_write(--ctx->regs.sp, data & 0xFF);
+}
+
 #endif /* __STACK_H__ */
@@ -0,0 +1,46 @@
+#ifndef __TILE_H__
+#define __TILE_H__
+
+#include <common.h>
+
+/*
+    2bpp tile row kernels
+
+    A row of tile data is two bytes, the low and high bit of each of its
+    8 pixels with the leftmost in bit 7. Decoding interleaves them into 8
+    color indices, expanding maps those through a 4 color palette into
+    ARGB pixels.
+
+    tile_init picks the widest implementation the host CPU runs: AVX2,
+    SSE2 or plain C. Until then, and on other hosts and compilers, the
+    plain C one is used.
+*/
+
+typedef struct {
+    const char *name;
+
+    // 8 indices, leftmost pixel first or last if flip is set
+    void (*decode_row)(u8 low, u8 high, bool flip, u8 *indices);
+
+    // 8 pixels from 8 indices in 0-3
+    void (*expand_row)(const u8 *indices, const u32 *palette, u32 *pixels);
+} tile_kernels;
+
+extern const tile_kernels *tile_active;
+
+void tile_init();
+
+// Every implementation built in, for comparing them. NULL for the ones
+// the host CPU can't run.
+int tile_kernel_count();
+const tile_kernels *tile_kernel(int n);
+
+ALWAYS_INLINE void tile_decode_row(u8 low, u8 high, bool flip, u8 *indices) {
+    tile_active->decode_row(low, high, flip, indices);
+}
+
+ALWAYS_INLINE void tile_expand_row(const u8 *indices, const u32 *palette, u32 *pixels) {
+    tile_active->expand_row(indices, palette, pixels);
+}
+
+#endif /* __TILE_H__ */
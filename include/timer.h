@@ -5,15 +5,18 @@
 
 // Timer context including divider registers
 // Reference: https://gbdev.io/pandocs/Timer_and_Divider_Registers.html
+// DIV and TIMA are not stepped, they are worked out from the tick counter
+// when the CPU reads them or the scheduler asks for the next overflow
 typedef struct {
-    u16 div;           // divider register (address FF04)
+    u64 div_offset;    // internal divider is tick + div_offset, DIV (FF04) is its upper byte
+    u64 tima_tick;     // tick tima is current to
     u8 tima;           // timer counter    (address FF05)
     u8 tma;            // timer modulo     (address FF06)
     u8 tac;            // timer control    (address FF07)
 } timer_context;
 
 void timer_init();
-void timer_tick();
+void timer_event(u64 when);
 
 void timer_write(u16 address, u8 value);
 u8 timer_read(u16 address);
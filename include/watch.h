@@ -0,0 +1,52 @@
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <common.h>
+
+/*
+    Memory watchpoints
+
+    Every page a watchpoint touches is held off the bus page tables, so
+    its accesses go through the bus handlers, which report them here.
+    Pages without a watchpoint keep their direct mappings and pay nothing.
+
+    Operand bytes are read like any other memory, only opcode fetches count
+    as execution. A pause takes effect at the end of the current batch of
+    instructions when the CPU runs in batches.
+*/
+
+#define WATCH_MAX 16
+
+typedef enum {
+    WATCH_READ = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+    WATCH_EXEC = 1 << 2,
+} watch_kind;
+
+typedef struct {
+    bool active;
+    u16 start;
+    u16 end;            // last address watched
+    u8 kinds;           // watch_kind flags
+    bool pause;         // set emu_context.paused on a hit
+    u64 hits;
+} watchpoint;
+
+// Kinds watched somewhere on each page, for paths that bypass the bus
+extern u8 watch_pages[0x100];
+
+// Returns the watchpoint number, -1 if all of them are in use
+int watch_add(u16 start, u16 end, u8 kinds, bool pause);
+void watch_remove(int n);
+void watch_clear();
+
+// Add a watchpoint from a spec like "rwxp:C000-C0FF", any of r, w and x
+// select the kinds and p pauses on a hit. A single address needs no end.
+int watch_parse(const char *spec);
+
+watchpoint *watch_get(int n);
+
+// Called by the bus for every access to a watched page
+void watch_hit(watch_kind kind, u16 address, u8 value);
+
+#endif /* __WATCH_H__ */
@@ -5,6 +5,8 @@
 #include <io.h>
 #include <ppu.h>
 #include <dma.h>
+#include <emu.h>
+#include <watch.h>
 
 /*
     Memory Map Addresses
@@ -25,7 +27,85 @@
     0xFF80 - 0xFFFE : Zero Page
 */
 
-u8 bus_read(u16 address) {
+u8 *bus_read_map[0x100];
+u8 *bus_write_map[0x100];
+u8 *bus_write_dirty[0x100];
+
+// Owners holding each page and the mappings kept aside for them
+static u8 bus_held[0x100];
+static u8 *held_read_map[0x100];
+static u8 *held_write_map[0x100];
+static u8 *held_write_dirty[0x100];
+
+// Each page points at its own offset of mem, so page[address & 0xFF]
+// lands on the right byte
+void bus_map_read(u16 address, u32 size, u8 *mem) {
+    for (u32 offset = 0; offset < size; offset += 0x100) {
+        u8 page = (address + offset) >> 8;
+        u8 **map = bus_held[page] ? held_read_map : bus_read_map;
+
+        map[page] = mem ? mem + offset : NULL;
+    }
+}
+
+void bus_map_write(u16 address, u32 size, u8 *mem, u8 *dirty) {
+    for (u32 offset = 0; offset < size; offset += 0x100) {
+        u8 page = (address + offset) >> 8;
+        u8 **map = bus_held[page] ? held_write_map : bus_write_map;
+        u8 **flags = bus_held[page] ? held_write_dirty : bus_write_dirty;
+
+        map[page] = mem ? mem + offset : NULL;
+        flags[page] = mem ? dirty + (offset >> 8) : NULL;
+    }
+}
+
+void bus_hold(u16 address, u32 size, u8 owner) {
+    for (u32 offset = 0; offset < size; offset += 0x100) {
+        u8 page = (address + offset) >> 8;
+
+        if (bus_held[page]) {
+            bus_held[page] |= owner;
+            continue;
+        }
+
+        bus_held[page] = owner;
+        held_read_map[page] = bus_read_map[page];
+        held_write_map[page] = bus_write_map[page];
+        held_write_dirty[page] = bus_write_dirty[page];
+        bus_read_map[page] = NULL;
+        bus_write_map[page] = NULL;
+    }
+}
+
+void bus_release(u8 owner) {
+    for (int page = 0; page < 0x100; page++) {
+        if (!(bus_held[page] & owner)) {
+            continue;
+        }
+
+        bus_held[page] &= ~owner;
+
+        if (bus_held[page]) {
+            continue;
+        }
+
+        bus_read_map[page] = held_read_map[page];
+        bus_write_map[page] = held_write_map[page];
+        bus_write_dirty[page] = held_write_dirty[page];
+    }
+}
+
+u8 bus_holder(u16 address) {
+    return bus_held[address >> 8];
+}
+
+u8 *bus_page(u16 address) {
+    u8 page = address >> 8;
+
+    return bus_held[page] ? held_read_map[page] : bus_read_map[page];
+}
+
+static u8 bus_decode_read(u16 address) {
     if (address < 0x8000) {
         // Reading ROM data
         return cart_read(address);
@@ -43,9 +123,6 @@ u8 bus_read(u16 address) {
         return 0;
     } else if (address < 0xFEA0) {
         // Object Attribute Memory (OAM)
-        if (dma_transferring()) {
-            return 0xFF;
-        }
         return ppu_oam_read(address);
     } else if (address < 0xFF00) {
         // Reversed unusable section
@@ -62,13 +139,53 @@ u8 bus_read(u16 address) {
     return hram_read(address);
 }
 
-void bus_write(u16 address, u8 value) {
+u8 bus_peek_handler(u16 address) {
+    if (bus_held[address >> 8] & BUS_HOLD_DMA) {
+        return dma_conflict_read(address);
+    }
+
+    return bus_decode_read(address);
+}
+
+u8 bus_read_handler(u16 address) {
+    u8 value = bus_peek_handler(address);
+
+    if (bus_held[address >> 8] & BUS_HOLD_WATCH) {
+        watch_hit(WATCH_READ, address, value);
+    }
+
+    return value;
+}
+
+u8 bus_fetch_handler(u16 address) {
+    u8 value = bus_peek_handler(address);
+
+    if (bus_held[address >> 8] & BUS_HOLD_WATCH) {
+        watch_hit(WATCH_EXEC, address, value);
+    }
+
+    return value;
+}
+
+void bus_write_handler(u16 address, u8 value) {
+    u8 held = bus_held[address >> 8];
+
+    if (held & BUS_HOLD_WATCH) {
+        watch_hit(WATCH_WRITE, address, value);
+    }
+
+    if (held & BUS_HOLD_DMA) {
+        // Lost to the DMA
+        return;
+    }
+
     if (address < 0x8000) {
         // Writing ROM data
         cart_write(address, value);
         return;
     } else if (address < 0xA000) {
-        // Character and Map data
+        // Character and Map data, drawn up to now with the old value
+        ppu_sync(emu_get_context()->ticks);
         ppu_vram_write(address, value);
     } else if (address < 0xC000) {
         // Cartridge RAM
@@ -80,9 +197,7 @@ void bus_write(u16 address, u8 value) {
         // Reserved Echo RAM (unusable)
     } else if (address < 0xFEA0) {
         // Object Attribute Memory (OAM)
-        if (dma_transferring()) {
-            return;
-        }
+        ppu_sync(emu_get_context()->ticks);
         ppu_oam_write(address, value);
     } else if (address < 0xFF00) {
         // Reversed unusable section
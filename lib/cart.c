@@ -2,78 +2,229 @@
 #include <rom_types.h>
 #include <lic_codes.h>
 #include <string.h>
-
-typedef struct {
-    char filename[1024];
-    u32 rom_size;
-    u8 *rom_data;
-    rom_header *header;
-
-    // MBC1 Data
-    bool ram_enabled;
-    bool ram_banking;
-
-    u8 *rom_bank_x;
-    u8 banking_mode;
-
-    u8 rom_bank_value;
-    u8 ram_bank_value;
-
-    u8 *ram_bank;               // currently selected RAM bank
-    u8 *ram_banks[16];          // all RAM banks (max 16 total)
-
-    // Battery Data
-    bool battery;               // whether it has battery or not
-    bool need_save;             // whether we should save battery backup or not
-} cart_context;
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <jit.h>
+#include <bus.h>
+#include <mapper.h>
 
 static cart_context ctx;
 
-bool cart_need_save() {
-    return ctx.need_save;
+cart_context *cart_get_context() {
+    return &ctx;
 }
 
-// MBC1 mapper found between cartridge codes 1 and 3 in cartridge header
-// Reference: https://gbdev.io/pandocs/The_Cartridge_Header.html#0147--cartridge-type 
-bool cart_mbc1() {
-    return BETWEEN(ctx.header->type, 1, 3);
+// A mapped battery file is written back by the kernel, saving only asks for
+// the pages written since the last save to go soon, which is cheap enough
+// to do every time
+bool cart_need_save() {
+    return ctx.need_save || ctx.battery_mapped;
 }
 
-// Returns true if cartridge type is MBC1+RAM+BATTERY
+// Cartridge types with a battery backing their RAM
+// Reference: https://gbdev.io/pandocs/The_Cartridge_Header.html#0147--cartridge-type
 bool cart_battery() {
-    return ctx.header->type == 3;
+    switch (ctx.header.type) {
+        case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F:
+        case 0x10: case 0x13: case 0x1B: case 0x1E: case 0x22:
+            return true;
+    }
+    return false;
 }
 
 // Returns licensee code string based on cartridge header
 const char *cart_lic_name() {
-    if (ctx.header->new_lic_code <= 0xA4) {
-        return LIC_CODE[ctx.header->lic_code];
+    if (ctx.header.new_lic_code <= 0xA4) {
+        return LIC_CODE[ctx.header.lic_code];
     }
     return "UNKNOWN";
 }
 
 // Returns cartridge type string based on cartridge header
 const char *cart_type_name() {
-    if (ctx.header->type <= 0x22) {
-        return ROM_TYPES[ctx.header->type];
+    if (ctx.header.type <= 0x22) {
+        return ROM_TYPES[ctx.header.type];
     }
     return "UNKNOWN";
 }
 
+// The .battery file, kept open and locked by the first instance of the ROM
+// that opens it for as long as it runs. Other instances of the same ROM
+// find it locked and keep their RAM to themselves instead of sharing, or
+// overwriting, that instance's save. create makes the file if it's missing.
+static int cart_battery_open(bool create) {
+    if (ctx.battery_fd >= 0 || ctx.battery_shared) {
+        return ctx.battery_fd;
+    }
+
+    char fn[1048];
+    sprintf(fn, "%s.battery", ctx.filename);
+
+    int fd = open(fn, O_RDWR | (create ? O_CREAT : 0), 0644);
+
+    if (fd < 0) {
+        if (create) {
+            fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
+        }
+
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB)) {
+        fprintf(stderr, "%s is in use by another instance, saves stay in memory\n", fn);
+        close(fd);
+        ctx.battery_shared = true;
+        return -1;
+    }
+
+    ctx.battery_fd = fd;
+    return fd;
+}
+
+// Back battery RAM with an existing .battery file itself. Writes land in
+// the page cache and the kernel writes them back on its own, so the
+// emulation thread never waits on the disk and every bank is saved. A
+// missing or shorter file (e.g. only the first bank saved) is only made or
+// grown by the first save.
+static u8 *cart_battery_map() {
+    int fd = cart_battery_open(false);
+    struct stat st;
+    u8 *ram = MAP_FAILED;
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)ctx.ram_size) {
+        ram = mmap(NULL, ctx.ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    return ram == MAP_FAILED ? NULL : ram;
+}
+
+// RAM size in bytes for each header RAM size code
+// Reference: https://gbdev.io/pandocs/The_Cartridge_Header.html#0149--ram-size
+static const u32 ram_sizes[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
 void cart_setup_banking() {
-    for (int i = 0; i < 16; i++) {
-        ctx.ram_banks[i] = 0;
-
-        // Check if number of banks corresponds to RAM size
-        if ((ctx.header->ram_size == 2 && i == 0) || (ctx.header->ram_size == 3 && i < 4) ||
-           (ctx.header->ram_size == 4 && i < 16) || (ctx.header->ram_size == 5 && i < 8)) {
-            ctx.ram_banks[i] = malloc(0x2000);
-            memset(ctx.ram_banks[i], 0, 0x2000);
+    u32 ram_size = ctx.header.ram_size < 6 ? ram_sizes[ctx.header.ram_size] : 0;
+
+    // MBC2 has its RAM built in and reports none in the header
+    if (BETWEEN(ctx.header.type, 0x05, 0x06)) {
+        ram_size = 0x200;
+    } else if (ram_size && ram_size < 0x2000) {
+        ram_size = 0x2000;                  // a 2 KB chip still takes up a whole bank
+    }
+
+    ctx.ram_size = ram_size;
+    ctx.ram_data = NULL;
+    ctx.battery_mapped = false;
+
+    if (ram_size && ctx.battery) {
+        ctx.ram_data = cart_battery_map();
+        ctx.battery_mapped = ctx.ram_data != NULL;
+    }
+
+    if (ram_size && !ctx.ram_data) {
+        ctx.ram_data = calloc(ram_size, 1);
+    }
+
+    if (ram_size) {
+        dirty_init(&ctx.ram_dirty, ram_size, 8);
+        dirty_view_init(&ctx.ram_saved, &ctx.ram_dirty);
+    }
+
+    ctx.ram_enabled = false;
+    ctx.banking_mode = 0;
+    ctx.rom_bank_value = 1;
+    ctx.ram_bank_value = 0;
+}
+
+// Bank switches are frequent, only touch the pages whose bank changed
+static void cart_map_read(u16 address, u32 size, u8 *mem) {
+    if (bus_read_map[address >> 8] != mem) {
+        bus_map_read(address, size, mem);
+    }
+}
+
+static void cart_map_write(u16 address, u32 size, u8 *mem) {
+    if (bus_write_map[address >> 8] != mem) {
+        u8 *dirty = mem ? ctx.ram_dirty.blocks + ((mem - ctx.ram_data) >> 8) : NULL;
+        bus_map_write(address, size, mem, dirty);
+    }
+}
+
+// Work out the banks switched in from the mapper registers and map them
+// straight into the bus. Mapper registers, RAM the mapper has to see
+// (MBC2, the RTC) and writes to battery RAM that isn't backed by the file,
+// which have to flag the save, stay with cart_read/cart_write.
+static void cart_map() {
+    ctx.mapper->map(&ctx);
+
+    cart_map_read(0x0000, 0x4000, ctx.rom_bank_0);
+    cart_map_read(0x4000, 0x4000, ctx.rom_bank_x);
+    cart_map_read(0xA000, 0x2000, ctx.ram_bank);
+    cart_map_write(0xA000, 0x2000, ctx.battery && !ctx.battery_mapped ? NULL : ctx.ram_bank);
+
+#if CPU_JIT
+    jit_map_rom_bank0((ctx.rom_bank_0 - ctx.rom_data) / 0x4000);
+    jit_map_rom_bank((ctx.rom_bank_x - ctx.rom_data) / 0x4000);
+#endif
+}
+
+// Map the ROM file read-only. The pages come straight from the page cache,
+// so every instance running the same ROM shares them. Files that aren't a
+// whole number of banks are copied instead, padded with open bus.
+static u8 *cart_map_file(int fd) {
+    u32 size = ctx.rom_banks * 0x4000;
+
+    if (size == ctx.rom_size) {
+        u8 *rom = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (rom != MAP_FAILED) {
+            madvise(rom, size, MADV_WILLNEED);
+            return rom;
         }
     }
 
-    ctx.ram_bank = ctx.ram_banks[0];
-    ctx.rom_bank_x = ctx.rom_data + 0x4000;   // RROM bank 1
+    u8 *rom = malloc(size);
+
+    if (!rom) {
+        return NULL;
+    }
+
+    memset(rom, 0xFF, size);
+
+    if (pread(fd, rom, ctx.rom_size, 0) != (ssize_t)ctx.rom_size) {
+        free(rom);
+        return NULL;
+    }
+
+    return rom;
+}
+
+// Parse the header located at 0x100
+// Reference: https://gbdev.io/pandocs/The_Cartridge_Header.html#0100-0103--entry-point
+static void cart_parse_header() {
+    const rom_header *raw = (const rom_header *)(ctx.rom_data + 0x100);
+
+    memcpy(ctx.header.title, raw->title, 15);
+    ctx.header.title[15] = 0;
+    ctx.header.new_lic_code = raw->new_lic_code;
+    ctx.header.type = raw->type;
+    ctx.header.rom_size = raw->rom_size;
+    ctx.header.ram_size = raw->ram_size;
+    ctx.header.lic_code = raw->lic_code;
+    ctx.header.version = raw->version;
+    ctx.header.checksum = raw->checksum;
+
+    // Header checksum (https://gbdev.io/pandocs/The_Cartridge_Header.html#014d--header-checksum)
+    u8 checksum = 0;
+    for (u16 address = 0x0134; address <= 0x014C; address++) {
+        checksum = checksum - ctx.rom_data[address] - 1;
+    }
+
+    ctx.header.checksum_ok = checksum == raw->checksum;
 }
 
 // Load each entry from cartridge header, returns true on success
@@ -81,57 +232,63 @@ void cart_setup_banking() {
 bool cart_load(char *cart) {
     snprintf(ctx.filename, sizeof(ctx.filename), "%s", cart);
 
-    FILE *fp = fopen(cart, "r");
+    int fd = open(cart, O_RDONLY);
+    struct stat st;
 
     // Check if file with specified filename exists
-    if (!fp) {
+    if (fd < 0 || fstat(fd, &st) < 0) {
         printf("Failed to open: %s\n", cart);
+
+        if (fd >= 0) {
+            close(fd);
+        }
         return false;
     }
 
     printf("Opened: %s\n", ctx.filename);
 
-    // Seek to end of file to determine size of it
-    fseek(fp, 0, SEEK_END);
-    ctx.rom_size = ftell(fp);
+    // Whole banks and at least 32 KB so every bank pointer covers 16 KB
+    ctx.rom_size = st.st_size;
+    ctx.rom_banks = (ctx.rom_size + 0x3FFF) / 0x4000;
 
-    // Move file descriptor back to the beginning of the file
-    rewind(fp);
+    if (ctx.rom_banks < 2) {
+        ctx.rom_banks = 2;
+    }
 
-    // Allocate and read in entire file data 
-    ctx.rom_data = malloc(ctx.rom_size);
-    fread(ctx.rom_data, ctx.rom_size, 1, fp);
-    fclose(fp);
+    ctx.rom_data = cart_map_file(fd);
+    close(fd);
+
+    if (!ctx.rom_data) {
+        printf("Failed to read: %s\n", cart);
+        return false;
+    }
 
-    // Read in header located at 0x100 (https://gbdev.io/pandocs/The_Cartridge_Header.html#0100-0103--entry-point)
-    ctx.header = (rom_header *)(ctx.rom_data + 0x100);
-    ctx.header->title[15] = 0;
+    cart_parse_header();
     ctx.battery = cart_battery();
+    ctx.battery_fd = -1;
+    ctx.battery_shared = false;
     ctx.need_save = false;
+    ctx.mapper = mapper_for_type(ctx.header.type);
 
     // Displaying cartridge context
     printf("Cartridge Loaded:\n");
-    printf("\t Title    : %s\n", ctx.header->title);
-    printf("\t Type     : %2.2X (%s)\n", ctx.header->type, cart_type_name());
-    printf("\t ROM Size : %d KB\n", 32 << ctx.header->rom_size);
-    printf("\t RAM Size : %2.2X\n", ctx.header->ram_size);
-    printf("\t LIC Code : %2.2X (%s)\n", ctx.header->lic_code, cart_lic_name());
-    printf("\t ROM Vers : %2.2X\n", ctx.header->version);
+    printf("\t Title    : %s\n", ctx.header.title);
+    printf("\t Type     : %2.2X (%s)\n", ctx.header.type, cart_type_name());
+    printf("\t Mapper   : %s\n", ctx.mapper->name);
+    printf("\t ROM Size : %d KB\n", 32 << ctx.header.rom_size);
+    printf("\t RAM Size : %2.2X\n", ctx.header.ram_size);
+    printf("\t LIC Code : %2.2X (%s)\n", ctx.header.lic_code, cart_lic_name());
+    printf("\t ROM Vers : %2.2X\n", ctx.header.version);
+    printf("\t Checksum : %2.2X (%s)\n", ctx.header.checksum, ctx.header.checksum_ok ? "PASSED" : "FAILED");
 
     cart_setup_banking();
 
-    // Run header checksum to validate ROM file (https://gbdev.io/pandocs/The_Cartridge_Header.html#014d--header-checksum)
-    u16 checksum = 0;
-    for (u16 address = 0x0134; address <= 0x014C; address++) {
-        checksum = checksum - ctx.rom_data[address] - 1;
-    }
-
-    printf("\t Checksum : %2.2X (%s)\n", ctx.header->checksum, (checksum & 0xFF) ? "PASSED" : "FAILED");
-
-    if (ctx.battery) {
+    if (ctx.battery && ctx.ram_data && !ctx.battery_mapped) {
         cart_battery_load();
     }
 
+    cart_map();
+
     return true;
 }
 
@@ -140,111 +297,102 @@ void cart_battery_load() {
     sprintf(fn, "%s.battery", ctx.filename);
     FILE *fp = fopen(fn, "rb");
 
+    // Nothing saved yet
     if (!fp) {
-        fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
+        if (errno != ENOENT) {
+            fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
+        }
+
         return;
     }
 
-    fread(ctx.ram_bank, 0x2000, 1, fp);
+    fread(ctx.ram_data, ctx.ram_size, 1, fp);
     fclose(fp);
 }
 
-void cart_battery_save() {
-    char fn[1048];
-    sprintf(fn, "%s.battery", ctx.filename);
-    FILE *fp = fopen(fn, "wb");
+// Ask for each run of pages written since the last save to be written
+// back, msync wants it to start on a host page
+static void cart_battery_sync() {
+    dirty_map *dirty = &ctx.ram_dirty;
+    u32 host_page = sysconf(_SC_PAGESIZE);
 
-    if (!fp) {
-        fprintf(stderr, "FAILED TO OPEN: %s\n", fn);
-        return;
-    }
+    for (u32 i = 0; i < dirty->count; i++) {
+        if (!dirty_take(&ctx.ram_saved, i)) {
+            continue;
+        }
 
-    fwrite(ctx.ram_bank, 0x2000, 1, fp);
-    fclose(fp);
-}
+        u32 start = i << dirty->shift;
 
-u8 cart_read(u16 address) {
-    if (!cart_mbc1() || address < 0x4000) {
-        return ctx.rom_data[address];
+        while (i + 1 < dirty->count && dirty_take(&ctx.ram_saved, i + 1)) {
+            i++;
+        }
+
+        u32 end = (i + 1) << dirty->shift;
+
+        start -= start % host_page;
+        msync(ctx.ram_data + start, end - start, MS_ASYNC);
     }
+}
 
-    // Check if address is in the range A000-BFFF (RAM bank)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#a000bfff--ram-bank-0003-if-any
-    if ((address & 0xE000) == 0xA000) {
-        if (!ctx.ram_enabled || !ctx.ram_bank) {
-            return 0xFF;
-        }
+void cart_battery_save() {
+    ctx.need_save = false;
 
-        return ctx.ram_bank[address - 0xA000];
+    if (ctx.battery_mapped) {
+        cart_battery_sync();
+        return;
     }
 
-    return ctx.rom_bank_x[address - 0x4000];
-}
+    int fd = cart_battery_open(true);
 
-void cart_write(u16 address, u8 value) {
-    if (!cart_mbc1()) {
+    if (fd < 0) {
         return;
     }
 
-    // Check if address is in the range 0000-1FFF (RAM enable)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#00001fff--ram-enable-write-only
-    if (address < 0x2000) {
-        ctx.ram_enabled = ((value & 0xF) == 0xA);    // any value with 0xA in lower 4 bits enables RAM
+    if (pwrite(fd, ctx.ram_data, ctx.ram_size, 0) != (ssize_t)ctx.ram_size) {
+        fprintf(stderr, "FAILED TO SAVE: %s.battery\n", ctx.filename);
     }
+}
 
-    // Check if address is in the range 2000-3FFF (ROM bank number)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#20003fff--rom-bank-number-write-only
-    if ((address & 0xE000) == 0x2000) {
-        if (value == 0) {
-            value = 1;                              // if register set to 0, it behaves as if set to 1
-        }
+// Only reached for the parts of 0000-7FFF and A000-BFFF the bus doesn't
+// map directly
+u8 cart_read(u16 address) {
+    if (address < 0x4000) {
+        return ctx.rom_bank_0[address];
+    }
 
-        value &= 0b11111;
-        ctx.rom_bank_value = value;
-        ctx.rom_bank_x = ctx.rom_data + (0x4000 * ctx.rom_bank_value);
+    if (address < 0x8000) {
+        return ctx.rom_bank_x[address - 0x4000];
     }
 
-    // Check if address is in the range 4000-5FFF (RAM bank number)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#40005fff--ram-bank-number--or--upper-bits-of-rom-bank-number-write-only
-    if ((address & 0xE000) == 0x4000) {
-        ctx.ram_bank_value = value & 0b11;
+    if (ctx.ram_bank) {
+        return ctx.ram_bank[address - 0xA000];
+    }
 
-        // Check if RAM banking is enabled
-        if (ctx.ram_banking) {
-            if (cart_need_save()) {
-                cart_battery_save();            // save battery when switching RAM banks
-            }
-            ctx.ram_bank = ctx.ram_banks[ctx.ram_bank_value];
-        }
+    if (ctx.mapper->ram_read) {
+        return ctx.mapper->ram_read(&ctx, address);
     }
 
-    // Check if address is in the range 6000-7FFF (Banking Mode Select)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#60007fff--banking-mode-select-write-only
-    if ((address & 0xE000) == 0x6000) {
-        ctx.banking_mode = value & 1;
-        ctx.ram_banking = ctx.banking_mode;
+    return 0xFF;
+}
 
-        // Check if RAM banking is enabled
-        if (ctx.ram_banking) {
-            if (cart_need_save()) {
-                cart_battery_save();            // save battery when switching RAM banks
-            }
-            ctx.ram_bank = ctx.ram_banks[ctx.ram_bank_value];
-        }
+void cart_write(u16 address, u8 value) {
+    // Any register write can change which banks the bus should see
+    if (address < 0x8000) {
+        ctx.mapper->write(&ctx, address, value);
+        cart_map();
+        return;
     }
 
-    // Check if address is in the range A000-BFFF (RAM bank)
-    // Reference: https://gbdev.io/pandocs/MBC1.html#a000bfff--ram-bank-0003-if-any
-    if ((address & 0xE000) == 0xA000) {
-        if (!ctx.ram_enabled || !ctx.ram_bank) {
-            return;
-        }
-
+    if (ctx.ram_bank) {
         ctx.ram_bank[address - 0xA000] = value;
+        dirty_mark(&ctx.ram_dirty, ctx.ram_bank - ctx.ram_data + address - 0xA000);
+    } else if (ctx.mapper->ram_write) {
+        ctx.mapper->ram_write(&ctx, address, value);
+    } else {
+        return;
+    }
 
-        if (ctx.battery) {
-            ctx.need_save = true;
-        }
+    if (ctx.battery && !ctx.battery_mapped) {
+        ctx.need_save = true;
     }
 }
-
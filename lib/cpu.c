@@ -2,107 +2,143 @@
 #include <bus.h>
 #include <emu.h>
 #include <interrupts.h>
-#include <dbg.h>
-#include <timer.h>
+#include <jit.h>
 
 cpu_context ctx = {0};
 
-// Sets debug mode on or off
-#define CPU_DEBUG 0
-
 // Assigning default values to all registers
 void cpu_init() {
     ctx.regs.pc = 0x100;
     ctx.regs.sp = 0xFFFE;
-    *((short *)&ctx.regs.a) = 0xB001;
-    *((short *)&ctx.regs.b) = 0x1300;
-    *((short *)&ctx.regs.d) = 0xD800;
-    *((short *)&ctx.regs.h) = 0x4D01;
+    ctx.regs.af = 0x01B0;
+    ctx.regs.bc = 0x0013;
+    ctx.regs.de = 0x00D8;
+    ctx.regs.hl = 0x014D;
     ctx.ie_register = 0;
     ctx.int_flags = 0;
     ctx.int_master_enabled = false;
     ctx.enabling_ime = false;
 
-    timer_get_context()->div = 0xABCC;
+#if CPU_JIT
+    jit_init();
+#endif
 }
 
+#if CPU_DEBUG == 1
+static u16 debug_pc;
+#endif
+
 static void fetch_instruction() {
+#if CPU_DEBUG == 1
+    debug_pc = ctx.regs.pc;
+#endif
     // Read op code and increment program counter
-    ctx.cur_opcode = bus_read(ctx.regs.pc++);
+    ctx.cur_opcode = bus_fetch(ctx.regs.pc++);
     // Get current instruction based on op code
     ctx.cur_inst = instruction_by_opcode(ctx.cur_opcode);
 }
 
-static void execute() {
-    // Run instruction type specific processor
-    IN_PROC proc = inst_get_processor(ctx.cur_inst->type);
+// Logs the instruction about to execute, called by the processors once
+// their operands are fetched
+void cpu_debug_trace(cpu_context *ctx) {
+#if CPU_DEBUG == 1
+    u16 pc = debug_pc;
+
+    cpu_flags_sync(ctx);
+
+    // Current instruction flags
+    char flags[16];
+    sprintf(flags, "%c%c%c%c", 
+        ctx->regs.f & (1 << 7) ? 'Z' : '-',
+        ctx->regs.f & (1 << 6) ? 'N' : '-',
+        ctx->regs.f & (1 << 5) ? 'H' : '-',
+        ctx->regs.f & (1 << 4) ? 'C' : '-'
+    );
+
+    char inst[16];
+    inst_to_str(ctx, inst);
+
+    // Current instruction logger
+    printf("%08llX - %04X: %-12s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n", 
+        emu_get_context()->ticks,
+        pc, inst, ctx->cur_opcode,
+        bus_read(pc + 1), bus_read(pc + 2), ctx->regs.a, flags, ctx->regs.b, ctx->regs.c, 
+        ctx->regs.d, ctx->regs.e, ctx->regs.h, ctx->regs.l);
+#endif
+}
 
-    if (!proc) {
-        NO_IMPL
+void cpu_complete_step(cpu_context *ctx) {
+    if (ctx->int_master_enabled) {
+        cpu_handle_interrupts(ctx);
+        ctx->enabling_ime = false;
     }
 
-    proc(&ctx);
+    if (ctx->enabling_ime) {
+        ctx->int_master_enabled = true;
+    }
 }
 
-void fetch_data();
-
 bool cpu_step() {
     if (!ctx.halted) {
-        u16 pc = ctx.regs.pc;
-
         fetch_instruction();
 
         emu_cycles(1);
 
-        fetch_data();
-
-#if CPU_DEBUG == 1
-        // Current instruction flags
-        char flags[16];
-        sprintf(flags, "%c%c%c%c", 
-            ctx.regs.f & (1 << 7) ? 'Z' : '-',
-            ctx.regs.f & (1 << 6) ? 'N' : '-',
-            ctx.regs.f & (1 << 5) ? 'H' : '-',
-            ctx.regs.f & (1 << 4) ? 'C' : '-'
-        );
-
-        char inst[16];
-        inst_to_str(&ctx, inst);
-
-        // Current instruction logger
-        printf("%08llX - %04X: %-12s (%02X %02X %02X) A: %02X F: %s BC: %02X%02X DE: %02X%02X HL: %02X%02X\n", 
-            emu_get_context()->ticks,
-            pc, inst, ctx.cur_opcode,
-            bus_read(pc + 1), bus_read(pc + 2), ctx.regs.a, flags, ctx.regs.b, ctx.regs.c, 
-            ctx.regs.d, ctx.regs.e, ctx.regs.h, ctx.regs.l);
-#endif
-
-        if (ctx.cur_inst == NULL) {
-            printf("Unknown Instruction! %02X\n", ctx.cur_opcode);
-            exit(-7);
-        }
-
-        // Output debug message for Blargg's tests
-        dbg_update();
-        dbg_print();
-
-        execute();
+        // Fetch operands and execute through the opcode's specialized processor
+        inst_processors[ctx.cur_opcode](&ctx);
     } else {
-        // is halted...
-        emu_cycles(1);
+        // is halted, jump straight to the next cycle an interrupt could
+        // be requested on
+        u32 quiet = ctx.int_flags ? 0 : emu_quiet_cycles();
+
+        if (quiet) {
+            emu_skip_cycles(quiet);
+        } else {
+            emu_cycles(1);
+        }
 
         if (ctx.int_flags) {
             ctx.halted = false;
         }
     }
 
-    if (ctx.int_master_enabled) {
-        cpu_handle_interrupts(&ctx);
-        ctx.enabling_ime = false;
-    }
+    cpu_complete_step(&ctx);
+    return true;
+}
+
+// Run up to max_steps instructions, the threaded loop hands back at every
+// event boundary and HALT is stepped one cycle at a time as in cpu_step()
+bool cpu_run_batch(u32 max_steps) {
+    u32 steps = 0;
+
+    while (steps < max_steps) {
+        if (ctx.halted || CPU_DEBUG) {
+            if (!cpu_step()) {
+                return false;
+            }
 
-    if (ctx.enabling_ime) {
-        ctx.int_master_enabled = true;
+            steps++;
+            continue;
+        }
+
+#if CPU_JIT
+        u32 n = jit_run(&ctx);
+
+        if (n) {
+            cpu_complete_step(&ctx);
+            steps += n;
+            continue;
+        }
+
+        // Code outside ROM and RAM is interpreted an instruction at a time
+        if (!cpu_step()) {
+            return false;
+        }
+
+        steps++;
+#else
+        steps += cpu_exec_batch(&ctx, max_steps - steps);
+#endif
     }
 
     return true;
@@ -2,6 +2,10 @@
 #include <emu.h>
 #include <bus.h>
 #include <stack.h>
+#include <cpu_fetch.h>
+#include <inst_table.h>
+#include <interrupts.h>
+#include <idle.h>
 
 /*
     Processing CPU Instructions
@@ -9,31 +13,38 @@
 */
 
 // None instruction
-static void proc_none(cpu_context *ctx) {
+ALWAYS_INLINE void proc_none(cpu_context *ctx, const instruction *inst) {
     printf("INVALID INSTRUCTION!\n");
     exit(-7);
 }
 
 // NOP instruction
-static void proc_nop(cpu_context *ctx) {}
+ALWAYS_INLINE void proc_nop(cpu_context *ctx, const instruction *inst) {}
 
 // Disable interrupts instruction
-static void proc_di(cpu_context *ctx) {
+ALWAYS_INLINE void proc_di(cpu_context *ctx, const instruction *inst) {
     ctx->int_master_enabled = false;
 }
 
 // Enable interrupts instruction
-static void proc_ei(cpu_context *ctx) {
+ALWAYS_INLINE void proc_ei(cpu_context *ctx, const instruction *inst) {
     ctx->enabling_ime = true;
 }
 
 // Returns true if register type is 16-bit
-static bool is_16_bit(reg_type rt) {
+ALWAYS_INLINE bool is_16_bit(reg_type rt) {
     return rt >= RT_AF;
 }
 
-// Sets flag bits
-void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c) {
+// Sets flag bits, a constant -1 leaves that flag untouched
+ALWAYS_INLINE void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c) {
+    // Flags kept from a deferred operation have to be computed first
+    if (z == -1 || n == -1 || h == -1 || c == -1) {
+        cpu_flags_sync(ctx);
+    }
+
+    ctx->flag_op = LF_NONE;
+
     if (z != -1) {
         BIT_SET(ctx->regs.f, 7, z);
     }
@@ -52,7 +63,7 @@ void cpu_set_flags(cpu_context *ctx, char z, char n, char h, char c) {
 }
 
 // Lookup table for register types
-reg_type rt_lookup[] = {
+static const reg_type rt_lookup[] = {
     RT_B,
     RT_C,
     RT_D,
@@ -64,7 +75,7 @@ reg_type rt_lookup[] = {
 };
 
 // Lookup the register type
-reg_type decode_reg(u8 reg) {
+ALWAYS_INLINE reg_type decode_reg(u8 reg) {
     if (reg > 0b111) { // 0b111 for the last three bits
         return RT_NONE;
     }
@@ -72,14 +83,33 @@ reg_type decode_reg(u8 reg) {
     return rt_lookup[reg];
 }
 
+// Read an 8-bit register, RT_HL reads the memory it points to
+ALWAYS_INLINE u8 reg8_read(cpu_context *ctx, reg_type rt) {
+    if (rt == RT_HL) {
+        return bus_read(cpu_regs_read(&ctx->regs, RT_HL));
+    }
+
+    return cpu_regs_read(&ctx->regs, rt);
+}
+
+// Set an 8-bit register, RT_HL writes the memory it points to
+ALWAYS_INLINE void reg8_set(cpu_context *ctx, reg_type rt, u8 val) {
+    if (rt == RT_HL) {
+        bus_write(cpu_regs_read(&ctx->regs, RT_HL), val);
+        return;
+    }
+
+    cpu_regs_set(&ctx->regs, rt, val);
+}
+
 // Bitwise operations
-// Decode second byte that comes after the CB instr
-static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
-    u8 op = ctx->fetched_data;
+// Decode second byte that comes after the CB instr, op is a constant in
+// each of the specialized CB processors so the decode below folds away
+ALWAYS_INLINE void cb_exec(cpu_context *ctx, u8 op) {      // reference prefix CB table
     reg_type reg = decode_reg(op & 0b111);
     u8 bit = (op >> 3) & 0b111;              // mask last three bits
     u8 bit_op = (op >> 6) & 0b11;            // mask last two bits
-    u8 reg_val = cpu_read_reg8(reg);
+    u8 reg_val = reg8_read(ctx, reg);
 
     emu_cycles(1);
 
@@ -94,12 +124,12 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
 
     case 2: // RST - reset
         reg_val &= ~(1 << bit);
-        cpu_set_reg8(reg, reg_val);
+        reg8_set(ctx, reg, reg_val);
         return;
 
     case 3: // SET
         reg_val |= (1 << bit);
-        cpu_set_reg8(reg, reg_val);
+        reg8_set(ctx, reg, reg_val);
         return;
     }
 
@@ -115,7 +145,7 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
                 result |= 1;
                 setC = true;
             }
-            cpu_set_reg8(reg, result);
+            reg8_set(ctx, reg, result);
             cpu_set_flags(ctx, result == 0, false, false, setC);
         } return;
     
@@ -124,7 +154,7 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
             reg_val >>= 1;
             reg_val |= (old << 7);
 
-            cpu_set_reg8(reg, reg_val);
+            reg8_set(ctx, reg, reg_val);
             cpu_set_flags(ctx, !reg_val, false, false, old & 1); // old & 1 - whether carry flag used
         } return;
 
@@ -133,7 +163,7 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
             reg_val <<= 1;
             reg_val |= flagC;
 
-            cpu_set_reg8(reg, reg_val);
+            reg8_set(ctx, reg, reg_val);
             cpu_set_flags(ctx, !reg_val, false, false, !!(old & 0x80)); // !!(old & 0x80) - if high bit set
         } return;
 
@@ -142,7 +172,7 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
             reg_val >>= 1;
             reg_val |= (flagC << 7);
 
-            cpu_set_reg8(reg, reg_val);
+            reg8_set(ctx, reg, reg_val);
             cpu_set_flags(ctx, !reg_val, false, false, old & 1);
         } return;
 
@@ -150,25 +180,25 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
             u8 old = reg_val;
             reg_val <<= 1;
 
-            cpu_set_reg8(reg, reg_val);
+            reg8_set(ctx, reg, reg_val);
             cpu_set_flags(ctx, !reg_val, false, false, !!(old & 0x80));
         } return;
 
         case 5: { // SRA - shift right and carry, MSB doesn't change
             u8 u = (int8_t) reg_val >> 1;
-            cpu_set_reg8(reg, u);
+            reg8_set(ctx, reg, u);
             cpu_set_flags(ctx, !u, 0, 0, reg_val & 1);
         } return;
 
         case 6: { // SWAP - high nibble swap with low nibble
             reg_val = ((reg_val & 0xF0) >> 4) | ((reg_val & 0xF) << 4);
-            cpu_set_reg8(reg, reg_val);
+            reg8_set(ctx, reg, reg_val);
             cpu_set_flags(ctx, reg_val == 0, false, false, false);
         } return;
 
         case 7: { // SRL - shift right and carry, msb set to 0
             u8 u = reg_val >> 1;
-            cpu_set_reg8(reg, u);
+            reg8_set(ctx, reg, u);
             cpu_set_flags(ctx, !u, 0, 0, reg_val & 1);
         } return;
 
@@ -179,7 +209,7 @@ static void proc_cb(cpu_context *ctx) {      // reference prefix CB table
 
 // RLCA (Rotate Left A Affect Carry) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#RLCA
-static void proc_rlca(cpu_context *ctx) {
+ALWAYS_INLINE void proc_rlca(cpu_context *ctx, const instruction *inst) {
     u8 u = ctx->regs.a;
     bool c = (u >> 7) & 1;
     u = (u << 1) | c;
@@ -190,7 +220,7 @@ static void proc_rlca(cpu_context *ctx) {
 
 // RRCA (Rotate Right A Affect Carry) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#RRCA
-static void proc_rrca(cpu_context *ctx) {
+ALWAYS_INLINE void proc_rrca(cpu_context *ctx, const instruction *inst) {
     u8 b = ctx->regs.a & 1;
     ctx->regs.a >>= 1;
     ctx->regs.a |= (b << 7);
@@ -200,7 +230,7 @@ static void proc_rrca(cpu_context *ctx) {
 
 // RLA (Rotate Left A) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#RLA
-static void proc_rla(cpu_context *ctx) {
+ALWAYS_INLINE void proc_rla(cpu_context *ctx, const instruction *inst) {
     u8 u = ctx->regs.a;
     u8 cf = CPU_FLAG_C;
     u8 c = (u >> 7) & 1;
@@ -211,7 +241,7 @@ static void proc_rla(cpu_context *ctx) {
 
 // RRA (Rotate Right A) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#RRA
-static void proc_rra(cpu_context *ctx) {
+ALWAYS_INLINE void proc_rra(cpu_context *ctx, const instruction *inst) {
     u8 carry = CPU_FLAG_C;
     u8 new_c = ctx->regs.a & 1;
 
@@ -222,13 +252,13 @@ static void proc_rra(cpu_context *ctx) {
 }
 
 // Stop instruction
-static void proc_stop(cpu_context *ctx) {
+ALWAYS_INLINE void proc_stop(cpu_context *ctx, const instruction *inst) {
     fprintf(stderr, "STOPPING!\n");
 }
 
 // DAA (Decimal Adjust Accumulator) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#DAA
-static void proc_daa(cpu_context *ctx) {
+ALWAYS_INLINE void proc_daa(cpu_context *ctx, const instruction *inst) {
     u8 u = 0;
     int fc = 0;
 
@@ -248,55 +278,53 @@ static void proc_daa(cpu_context *ctx) {
 
 // CPL (Complement Accumulator) instruction
 // Reference: https://rgbds.gbdev.io/docs/v0.7.0/gbz80.7#CPL
-static void proc_cpl(cpu_context *ctx) {
+ALWAYS_INLINE void proc_cpl(cpu_context *ctx, const instruction *inst) {
     ctx->regs.a = ~ctx->regs.a;
     cpu_set_flags(ctx, -1, 1, 1, -1);
 }
 
 // SCF (Set Carry Flag) instruction
-static void proc_scf(cpu_context *ctx) {
+ALWAYS_INLINE void proc_scf(cpu_context *ctx, const instruction *inst) {
     cpu_set_flags(ctx, -1, 0, 0, 1);
 }
 
 // CCF (Complement Carry Flag) instruction
-static void proc_ccf(cpu_context *ctx) {
+ALWAYS_INLINE void proc_ccf(cpu_context *ctx, const instruction *inst) {
     cpu_set_flags(ctx, -1, 0, 0, CPU_FLAG_C ^ 1);  // invert carry flag
 }
 
 // Halt instruction
-static void proc_halt(cpu_context *ctx) {
+ALWAYS_INLINE void proc_halt(cpu_context *ctx, const instruction *inst) {
     ctx->halted = true;
 }
 
 // AND instruction
-static void proc_and(cpu_context *ctx) {
+ALWAYS_INLINE void proc_and(cpu_context *ctx, const instruction *inst) {
     ctx->regs.a &= ctx->fetched_data;
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0, 1, 0);
+    cpu_defer_flags(ctx, LF_AND, 0, 0, 0, ctx->regs.a);
 }
 
 // XOR instruction
-static void proc_xor(cpu_context *ctx) {
+ALWAYS_INLINE void proc_xor(cpu_context *ctx, const instruction *inst) {
     ctx->regs.a ^= ctx->fetched_data & 0xFF;
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0, 0, 0);
+    cpu_defer_flags(ctx, LF_OR, 0, 0, 0, ctx->regs.a);
 }
 
 // OR instruction
-static void proc_or(cpu_context *ctx) {
+ALWAYS_INLINE void proc_or(cpu_context *ctx, const instruction *inst) {
     ctx->regs.a |= ctx->fetched_data & 0xFF;
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0, 0, 0);
+    cpu_defer_flags(ctx, LF_OR, 0, 0, 0, ctx->regs.a);
 }
 
 // CP (Compare) instruction
-static void proc_cp(cpu_context *ctx) {
-    int n = (int) ctx->regs.a - (int) ctx->fetched_data;
-    cpu_set_flags(ctx, n == 0, 1, 
-        ((int) ctx->regs.a & 0x0F) - ((int) ctx->fetched_data & 0x0F) < 0, n < 0);
+ALWAYS_INLINE void proc_cp(cpu_context *ctx, const instruction *inst) {
+    cpu_defer_flags(ctx, LF_SUB, ctx->regs.a, ctx->fetched_data, 0, ctx->regs.a - ctx->fetched_data);
 }
 
 // Load instruction
-static void proc_ld(cpu_context *ctx) {
-    if (ctx->dest_is_mem) {
-        if (is_16_bit(ctx->cur_inst->reg_2)) {   // in the form: LD (BC), A (and 16-bit register)
+ALWAYS_INLINE void proc_ld(cpu_context *ctx, const instruction *inst) {
+    if (mode_dest_is_mem(inst->mode)) {
+        if (is_16_bit(inst->reg_2)) {   // in the form: LD (BC), A (and 16-bit register)
             emu_cycles(1);
             bus_write16(ctx->mem_dest, ctx->fetched_data);
         } else {
@@ -307,27 +335,27 @@ static void proc_ld(cpu_context *ctx) {
         return;
     }
 
-    if (ctx->cur_inst->mode == AM_HL_SPR) {   // special case
-        u8 hflag = (cpu_read_reg(ctx->cur_inst->reg_2) & 0xF) + 
+    if (inst->mode == AM_HL_SPR) {   // special case
+        u8 hflag = (cpu_regs_read(&ctx->regs, inst->reg_2) & 0xF) + 
             (ctx->fetched_data & 0xF) >= 0x10;
 
-        u8 cflag = (cpu_read_reg(ctx->cur_inst->reg_2) & 0xFF) + 
+        u8 cflag = (cpu_regs_read(&ctx->regs, inst->reg_2) & 0xFF) + 
             (ctx->fetched_data & 0xFF) >= 0x100;
 
         cpu_set_flags(ctx, 0, 0, hflag, cflag);
-        cpu_set_reg(ctx->cur_inst->reg_1, 
-            cpu_read_reg(ctx->cur_inst->reg_2) + (char)ctx->fetched_data);
+        cpu_regs_set(&ctx->regs, inst->reg_1, 
+            cpu_regs_read(&ctx->regs, inst->reg_2) + (char)ctx->fetched_data);
 
         return;
     }
 
-    cpu_set_reg(ctx->cur_inst->reg_1, ctx->fetched_data);
+    cpu_regs_set(&ctx->regs, inst->reg_1, ctx->fetched_data);
 }
 
 // LDH (Load High) instruction
-static void proc_ldh(cpu_context *ctx) {
-    if (ctx->cur_inst->reg_1 == RT_A) {
-        cpu_set_reg(ctx->cur_inst->reg_1, bus_read(0xFF00 | ctx->fetched_data));
+ALWAYS_INLINE void proc_ldh(cpu_context *ctx, const instruction *inst) {
+    if (inst->reg_1 == RT_A) {
+        cpu_regs_set(&ctx->regs, inst->reg_1, bus_read(0xFF00 | ctx->fetched_data));
     } else {
         bus_write(ctx->mem_dest, ctx->regs.a);
     }
@@ -336,11 +364,11 @@ static void proc_ldh(cpu_context *ctx) {
 }
 
 // Returns bool representing if condition is satisfied
-static bool check_cond(cpu_context *ctx) {
+ALWAYS_INLINE bool check_cond(cpu_context *ctx, const instruction *inst) {
     bool z = CPU_FLAG_Z;
     bool c = CPU_FLAG_C;
 
-    switch(ctx->cur_inst->cond) {
+    switch(inst->cond) {
         case CT_NONE: return true;
         case CT_C: return c;
         case CT_NC: return !c;
@@ -351,11 +379,11 @@ static bool check_cond(cpu_context *ctx) {
     return false;
 }
 
-static void goto_addr(cpu_context *ctx, u16 addr, bool pushpc) {
-    if (check_cond(ctx)) {                     // checking if conditional flag is met
+ALWAYS_INLINE void goto_addr(cpu_context *ctx, const instruction *inst, u16 addr, bool pushpc) {
+    if (check_cond(ctx, inst)) {                     // checking if conditional flag is met
         if (pushpc) {                          // push pc to stack
             emu_cycles(2);
-            stack_push16(ctx->regs.pc);
+            stack_push16_cycles(ctx, ctx->regs.pc, 0);
         }
         ctx->regs.pc = addr;                   // set pc to address
         emu_cycles(1);
@@ -363,243 +391,365 @@ static void goto_addr(cpu_context *ctx, u16 addr, bool pushpc) {
 }
 
 // Jump instruction
-static void proc_jp(cpu_context *ctx) {
-    goto_addr(ctx, ctx->fetched_data, false);
+ALWAYS_INLINE void proc_jp(cpu_context *ctx, const instruction *inst) {
+    u16 from = ctx->regs.pc;
+    goto_addr(ctx, inst, ctx->fetched_data, false);
+
+    if (ctx->regs.pc < from) {                      // jumped back, may be a wait loop
+        idle_loop(ctx, from);
+    }
 }
 
 // Jump relative instruction
-static void proc_jr(cpu_context *ctx) {
+ALWAYS_INLINE void proc_jr(cpu_context *ctx, const instruction *inst) {
     char rel = (char)(ctx->fetched_data & 0xFF);   // casting to char because relative jump may be negative
+    u16 from = ctx->regs.pc;
     u16 addr = ctx->regs.pc + rel;
-    goto_addr(ctx, addr, false);
+    goto_addr(ctx, inst, addr, false);
+
+    if (ctx->regs.pc < from) {                      // jumped back, may be a wait loop
+        idle_loop(ctx, from);
+    }
 }
 
 // Call instruction
-static void proc_call(cpu_context *ctx) {
-    goto_addr(ctx, ctx->fetched_data, true);
+ALWAYS_INLINE void proc_call(cpu_context *ctx, const instruction *inst) {
+    goto_addr(ctx, inst, ctx->fetched_data, true);
 }
 
 // Restart instruction
-static void proc_rst(cpu_context *ctx) {
-    goto_addr(ctx, ctx->cur_inst->param, true);
+ALWAYS_INLINE void proc_rst(cpu_context *ctx, const instruction *inst) {
+    goto_addr(ctx, inst, inst->param, true);
 }
 
 // Return instruction
-static void proc_ret(cpu_context *ctx) {
-    if (ctx->cur_inst->cond != CT_NONE) {
+ALWAYS_INLINE void proc_ret(cpu_context *ctx, const instruction *inst) {
+    if (inst->cond != CT_NONE) {
         emu_cycles(1);
     }
 
-    if (check_cond(ctx)) {
-        u16 lo = stack_pop();
-        emu_cycles(1);
-        u16 hi = stack_pop();
-        emu_cycles(1);
-
-        u16 n = (hi << 8) | lo;
-        ctx->regs.pc = n;                   // set pc to value on stack
+    if (check_cond(ctx, inst)) {
+        ctx->regs.pc = stack_pop16_cycles(ctx, 1);  // set pc to value on stack
         emu_cycles(1);
     }
 }
 
 // Return interrupt instruction
-static void proc_reti(cpu_context *ctx) {
+ALWAYS_INLINE void proc_reti(cpu_context *ctx, const instruction *inst) {
     ctx->int_master_enabled = true;
-    proc_ret(ctx);
+    proc_ret(ctx, inst);
 }
 
 // Pop instruction
-static void proc_pop(cpu_context *ctx) {
-    u16 lo = stack_pop();
-    emu_cycles(1);
-    u16 hi = stack_pop();
-    emu_cycles(1);
-
-    u16 n = (hi << 8) | lo;
-    cpu_set_reg(ctx->cur_inst->reg_1, n);
+ALWAYS_INLINE void proc_pop(cpu_context *ctx, const instruction *inst) {
+    u16 n = stack_pop16_cycles(ctx, 1);
+    cpu_regs_set(&ctx->regs, inst->reg_1, n);
 
-    if (ctx->cur_inst->reg_1 == RT_AF) {
-        cpu_set_reg(ctx->cur_inst->reg_1, n & 0xFFF0);
+    if (inst->reg_1 == RT_AF) {
+        cpu_regs_set(&ctx->regs, inst->reg_1, n & 0xFFF0);
+        ctx->flag_op = LF_NONE;         // popped F replaces any deferred flags
     }
 }
 
 
 // Push instruction
-static void proc_push(cpu_context *ctx) {
-    u16 hi = (cpu_read_reg(ctx->cur_inst->reg_1) >> 8) & 0xFF;
-    emu_cycles(1);
-    stack_push(hi);
+ALWAYS_INLINE void proc_push(cpu_context *ctx, const instruction *inst) {
+    if (inst->reg_1 == RT_AF) {
+        cpu_flags_sync(ctx);
+    }
 
-    u16 lo = cpu_read_reg(ctx->cur_inst->reg_1) & 0xFF;
     emu_cycles(1);
-    stack_push(lo);
-
+    stack_push16_cycles(ctx, cpu_regs_read(&ctx->regs, inst->reg_1), 1);
     emu_cycles(1);
 }
 
 // Inc instruction
-static void proc_inc(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->cur_inst->reg_1) + 1;
+ALWAYS_INLINE void proc_inc(cpu_context *ctx, const instruction *inst) {
+    u16 val = cpu_regs_read(&ctx->regs, inst->reg_1) + 1;
 
-    if (is_16_bit(ctx->cur_inst->reg_1)) {          // 16 bit inc
+    if (is_16_bit(inst->reg_1)) {          // 16 bit inc
         emu_cycles(1);
     }
 
-    if (ctx->cur_inst->reg_1 == RT_HL && ctx->cur_inst->mode == AM_MR) {        // inc memory value at register address instead of register value
-        val = bus_read(cpu_read_reg(RT_HL)) + 1;
+    if (inst->reg_1 == RT_HL && inst->mode == AM_MR) {        // inc memory value at register address instead of register value
+        val = bus_read(cpu_regs_read(&ctx->regs, RT_HL)) + 1;
         val &= 0xFF;
-        bus_write(cpu_read_reg(RT_HL), val);
+        bus_write(cpu_regs_read(&ctx->regs, RT_HL), val);
     } else{
-        cpu_set_reg(ctx->cur_inst->reg_1, val);
-        val = cpu_read_reg(ctx->cur_inst->reg_1);
+        cpu_regs_set(&ctx->regs, inst->reg_1, val);
+        val = cpu_regs_read(&ctx->regs, inst->reg_1);
     }
 
-    if ((ctx->cur_opcode & 0x03) == 0x03) {         // 0x3 do not change flags
+    if (is_16_bit(inst->reg_1) && inst->mode != AM_MR) {         // 16-bit INC rr (opcodes x3) do not change flags
         return;
     }
 
-    cpu_set_flags(ctx, val == 0, 0, (val & 0x0F) == 0, -1);
+    cpu_defer_flags(ctx, LF_INC, 0, 0, CPU_FLAG_C, val);
 }
 
 // Dec instruction
-static void proc_dec(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->cur_inst->reg_1) - 1;
+ALWAYS_INLINE void proc_dec(cpu_context *ctx, const instruction *inst) {
+    u16 val = cpu_regs_read(&ctx->regs, inst->reg_1) - 1;
 
-    if (is_16_bit(ctx->cur_inst->reg_1)) {          // 16 bit dec
+    if (is_16_bit(inst->reg_1)) {          // 16 bit dec
         emu_cycles(1);
     }
 
-    if (ctx->cur_inst->reg_1 == RT_HL && ctx->cur_inst->mode == AM_MR) {        // dec memory value at register address instead of register value
-        val = bus_read(cpu_read_reg(RT_HL)) - 1;
-        bus_write(cpu_read_reg(RT_HL), val);
+    if (inst->reg_1 == RT_HL && inst->mode == AM_MR) {        // dec memory value at register address instead of register value
+        val = bus_read(cpu_regs_read(&ctx->regs, RT_HL)) - 1;
+        bus_write(cpu_regs_read(&ctx->regs, RT_HL), val);
     } else{
-        cpu_set_reg(ctx->cur_inst->reg_1, val);
-        val = cpu_read_reg(ctx->cur_inst->reg_1);
+        cpu_regs_set(&ctx->regs, inst->reg_1, val);
+        val = cpu_regs_read(&ctx->regs, inst->reg_1);
     }
 
-    if ((ctx->cur_opcode & 0x0B) == 0x0B) {         // 0xB do not change flags
+    if (is_16_bit(inst->reg_1) && inst->mode != AM_MR) {         // 16-bit DEC rr (opcodes xB) do not change flags
         return;
     }
 
-    cpu_set_flags(ctx, val == 0, 1, (val & 0x0F) == 0x0F, -1);
+    cpu_defer_flags(ctx, LF_DEC, 0, 0, CPU_FLAG_C, val);
 }
 
 // Sub instruction
-static void proc_sub(cpu_context *ctx) {
-    u16 val = cpu_read_reg(ctx->cur_inst->reg_1) - ctx->fetched_data;       // subtract reg value by literal value
-    
-    int z = val == 0;
-    int h = ((int)cpu_read_reg(ctx->cur_inst->reg_1) & 0xF) - ((int)ctx->fetched_data & 0xF) < 0;
-    int c = ((int)cpu_read_reg(ctx->cur_inst->reg_1)) - ((int)ctx->fetched_data) < 0;
+ALWAYS_INLINE void proc_sub(cpu_context *ctx, const instruction *inst) {
+    u16 val = cpu_regs_read(&ctx->regs, inst->reg_1) - ctx->fetched_data;       // subtract reg value by literal value
 
-    cpu_set_reg(ctx->cur_inst->reg_1, val);
-    cpu_set_flags(ctx, z, 1, h, c);
+    cpu_defer_flags(ctx, LF_SUB, cpu_regs_read(&ctx->regs, inst->reg_1), ctx->fetched_data, 0, val);
+    cpu_regs_set(&ctx->regs, inst->reg_1, val);
 }
 
 // Sbc instruction
-static void proc_sbc(cpu_context *ctx) {
-    u8 val = ctx->fetched_data + CPU_FLAG_C;        // subtracted value is literal plus carry bit
-
-    int z = cpu_read_reg(ctx->cur_inst->reg_1) - val == 0;
-
-    int h = ((int)cpu_read_reg(ctx->cur_inst->reg_1) & 0xF) 
-        - ((int)ctx->fetched_data & 0xF) - ((int)CPU_FLAG_C) < 0;
-    int c = ((int)cpu_read_reg(ctx->cur_inst->reg_1)) 
-        - ((int)ctx->fetched_data) - ((int)CPU_FLAG_C) < 0;
+ALWAYS_INLINE void proc_sbc(cpu_context *ctx, const instruction *inst) {
+    u8 carry = CPU_FLAG_C;
+    u8 val = ctx->fetched_data + carry;        // subtracted value is literal plus carry bit
+    u8 a = cpu_regs_read(&ctx->regs, inst->reg_1);
 
-    cpu_set_reg(ctx->cur_inst->reg_1, cpu_read_reg(ctx->cur_inst->reg_1) - val);
-    cpu_set_flags(ctx, z, 1, h, c);
+    cpu_regs_set(&ctx->regs, inst->reg_1, a - val);
+    cpu_defer_flags(ctx, LF_SUB, a, ctx->fetched_data, carry, a - val);
 }
 
 // Adc instruction
-static void proc_adc(cpu_context *ctx) {
+ALWAYS_INLINE void proc_adc(cpu_context *ctx, const instruction *inst) {
     u16 u = ctx->fetched_data;
     u16 a = ctx->regs.a;
     u16 c = CPU_FLAG_C;
 
     ctx->regs.a = (a + u + c) & 0xFF;           // add literal and carry bit to the a reg
 
-    cpu_set_flags(ctx, ctx->regs.a == 0, 0,
-        (a & 0xF) + (u & 0xF) + c > 0xF,
-        a + u + c > 0xFF);
+    cpu_defer_flags(ctx, LF_ADD, a, u, c, ctx->regs.a);
 }
 
 // Add instruction
-static void proc_add(cpu_context *ctx) {
-    u32 val = cpu_read_reg(ctx->cur_inst->reg_1) + ctx->fetched_data;       // add reg value and literal
+ALWAYS_INLINE void proc_add(cpu_context *ctx, const instruction *inst) {
+    u32 val = cpu_regs_read(&ctx->regs, inst->reg_1) + ctx->fetched_data;       // add reg value and literal
 
-    bool is_16bit = is_16_bit(ctx->cur_inst->reg_1);
+    bool is_16bit = is_16_bit(inst->reg_1);
 
     if (is_16bit) {         // 16 bit add
         emu_cycles(1);
     }
 
-    if (ctx->cur_inst->reg_1 == RT_SP) {            
-        val = cpu_read_reg(ctx->cur_inst->reg_1) + (char)ctx->fetched_data;         // casting to char because literal may be negative
+    if (inst->reg_1 == RT_SP) {            
+        val = cpu_regs_read(&ctx->regs, inst->reg_1) + (char)ctx->fetched_data;         // casting to char because literal may be negative
+    }
+
+    // 8 bit add to A, flags are recorded for later
+    if (inst->reg_1 == RT_A) {
+        cpu_defer_flags(ctx, LF_ADD, ctx->regs.a, ctx->fetched_data, 0, val);
+        ctx->regs.a = val & 0xFF;
+        return;
     }
 
-    // 8 bit add
     int z = (val & 0xFF) == 0;
-    int h = (cpu_read_reg(ctx->cur_inst->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
-    int c = (int)(cpu_read_reg(ctx->cur_inst->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
+    int h = (cpu_regs_read(&ctx->regs, inst->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
+    int c = (int)(cpu_regs_read(&ctx->regs, inst->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
 
     if (is_16bit) {         // 16 bit add
         z = -1;
-        h = (cpu_read_reg(ctx->cur_inst->reg_1) & 0xFFF) + (ctx->fetched_data & 0xFFF) >= 0x1000;
-        u32 n = ((u32)cpu_read_reg(ctx->cur_inst->reg_1)) + ((u32)ctx->fetched_data);
+        h = (cpu_regs_read(&ctx->regs, inst->reg_1) & 0xFFF) + (ctx->fetched_data & 0xFFF) >= 0x1000;
+        u32 n = ((u32)cpu_regs_read(&ctx->regs, inst->reg_1)) + ((u32)ctx->fetched_data);
         c = n >= 0x10000;
     }
 
-    if (ctx->cur_inst->reg_1 == RT_SP) {            // stack pointer treated as 8 bit add
+    if (inst->reg_1 == RT_SP) {            // stack pointer treated as 8 bit add
         z = 0;
-        h = (cpu_read_reg(ctx->cur_inst->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
-        c = (int)(cpu_read_reg(ctx->cur_inst->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
+        h = (cpu_regs_read(&ctx->regs, inst->reg_1) & 0xF) + (ctx->fetched_data & 0xF) >= 0x10;
+        c = (int)(cpu_regs_read(&ctx->regs, inst->reg_1) & 0xFF) + (int)(ctx->fetched_data & 0xFF) >= 0x100;
     }
 
-    cpu_set_reg(ctx->cur_inst->reg_1, val & 0xFFFF);
+    cpu_regs_set(&ctx->regs, inst->reg_1, val & 0xFFFF);
     cpu_set_flags(ctx, z, 0, h, c);
     
 }
 
-static IN_PROC processors[] = {
-    [IN_NONE] = proc_none,
-    [IN_NOP] = proc_nop,
-    [IN_LD] = proc_ld,
-    [IN_LDH] = proc_ldh,
-    [IN_JP] = proc_jp,
-    [IN_DI] = proc_di,
-    [IN_POP] = proc_pop,
-    [IN_PUSH] = proc_push,
-    [IN_JR] = proc_jr,
-    [IN_CALL] = proc_call,
-    [IN_RET] = proc_ret,
-    [IN_RETI] = proc_reti,
-    [IN_RST] = proc_rst,
-    [IN_DEC] = proc_dec,
-    [IN_INC] = proc_inc,
-    [IN_ADD] = proc_add,
-    [IN_ADC] = proc_adc,
-    [IN_SUB] = proc_sub,
-    [IN_SBC] = proc_sbc,
-    [IN_AND] = proc_and,
-    [IN_XOR] = proc_xor,
-    [IN_OR] = proc_or,
-    [IN_CP] = proc_cp,
-    [IN_CB] = proc_cb,
-    [IN_RRCA] = proc_rrca,
-    [IN_RLCA] = proc_rlca,
-    [IN_RRA] = proc_rra,
-    [IN_RLA] = proc_rla,
-    [IN_STOP] = proc_stop,
-    [IN_HALT] = proc_halt,
-    [IN_DAA] = proc_daa,
-    [IN_CPL] = proc_cpl,
-    [IN_SCF] = proc_scf,
-    [IN_CCF] = proc_ccf,
-    [IN_EI] = proc_ei
+// One processor per CB opcode, 0x00 to 0xFF
+#define CB_ROW(X, hi) \
+    X(hi##0) X(hi##1) X(hi##2) X(hi##3) X(hi##4) X(hi##5) X(hi##6) X(hi##7) \
+    X(hi##8) X(hi##9) X(hi##A) X(hi##B) X(hi##C) X(hi##D) X(hi##E) X(hi##F)
+
+#define CB_TABLE(X) \
+    CB_ROW(X, 0x0) CB_ROW(X, 0x1) CB_ROW(X, 0x2) CB_ROW(X, 0x3) \
+    CB_ROW(X, 0x4) CB_ROW(X, 0x5) CB_ROW(X, 0x6) CB_ROW(X, 0x7) \
+    CB_ROW(X, 0x8) CB_ROW(X, 0x9) CB_ROW(X, 0xA) CB_ROW(X, 0xB) \
+    CB_ROW(X, 0xC) CB_ROW(X, 0xD) CB_ROW(X, 0xE) CB_ROW(X, 0xF)
+
+#define CB_PROC(op) \
+static void cb_##op(cpu_context *ctx) { \
+    cb_exec(ctx, op); \
+}
+
+CB_TABLE(CB_PROC)
+
+#define CB_PROC_ENTRY(op) [op] = cb_##op,
+
+static IN_PROC cb_processors[0x100] = {
+    CB_TABLE(CB_PROC_ENTRY)
+};
+
+// CB prefix, the fetched byte selects the specialized CB processor
+ALWAYS_INLINE void proc_cb(cpu_context *ctx, const instruction *inst) {
+    cb_processors[ctx->fetched_data & 0xFF](ctx);
+}
+
+// Execute one instruction, inlined into each opcode's processor below
+// with inst pointing at a constant so the fetch and execute switches fold away
+ALWAYS_INLINE void inst_exec(cpu_context *ctx, const instruction *inst) {
+    fetch_data(ctx, inst);
+
+#if CPU_DEBUG == 1
+    cpu_debug_trace(ctx);
+#endif
+
+    switch(inst->type) {
+        case IN_NONE: proc_none(ctx, inst); break;
+        case IN_NOP: proc_nop(ctx, inst); break;
+        case IN_LD: proc_ld(ctx, inst); break;
+        case IN_LDH: proc_ldh(ctx, inst); break;
+        case IN_JP: proc_jp(ctx, inst); break;
+        case IN_DI: proc_di(ctx, inst); break;
+        case IN_POP: proc_pop(ctx, inst); break;
+        case IN_PUSH: proc_push(ctx, inst); break;
+        case IN_JR: proc_jr(ctx, inst); break;
+        case IN_CALL: proc_call(ctx, inst); break;
+        case IN_RET: proc_ret(ctx, inst); break;
+        case IN_RETI: proc_reti(ctx, inst); break;
+        case IN_RST: proc_rst(ctx, inst); break;
+        case IN_DEC: proc_dec(ctx, inst); break;
+        case IN_INC: proc_inc(ctx, inst); break;
+        case IN_ADD: proc_add(ctx, inst); break;
+        case IN_ADC: proc_adc(ctx, inst); break;
+        case IN_SUB: proc_sub(ctx, inst); break;
+        case IN_SBC: proc_sbc(ctx, inst); break;
+        case IN_AND: proc_and(ctx, inst); break;
+        case IN_XOR: proc_xor(ctx, inst); break;
+        case IN_OR: proc_or(ctx, inst); break;
+        case IN_CP: proc_cp(ctx, inst); break;
+        case IN_CB: proc_cb(ctx, inst); break;
+        case IN_RRCA: proc_rrca(ctx, inst); break;
+        case IN_RLCA: proc_rlca(ctx, inst); break;
+        case IN_RRA: proc_rra(ctx, inst); break;
+        case IN_RLA: proc_rla(ctx, inst); break;
+        case IN_STOP: proc_stop(ctx, inst); break;
+        case IN_HALT: proc_halt(ctx, inst); break;
+        case IN_DAA: proc_daa(ctx, inst); break;
+        case IN_CPL: proc_cpl(ctx, inst); break;
+        case IN_SCF: proc_scf(ctx, inst); break;
+        case IN_CCF: proc_ccf(ctx, inst); break;
+        case IN_EI: proc_ei(ctx, inst); break;
+        default: NO_IMPL
+    }
+}
+
+// One processor per opcode, generated from the opcode table
+#define INST_PROC(op, type, mode, reg_1, reg_2, cond, param) \
+static void op_##op(cpu_context *ctx) { \
+    static const instruction inst = {type, mode, reg_1, reg_2, cond, param}; \
+    inst_exec(ctx, &inst); \
+}
+
+INST_TABLE(INST_PROC)
+
+#define INST_PROC_ENTRY(op, type, mode, reg_1, reg_2, cond, param) [op] = op_##op,
+
+IN_PROC inst_processors[0x100] = {
+    INST_TABLE(INST_PROC_ENTRY)
 };
 
-// Run processor for each instruction type
-IN_PROC inst_get_processor(in_type type) {
-    return processors[type];
+// Batch interpreter loop: runs up to max_steps instructions with every
+// opcode's processor inlined into the loop and the dispatch replicated at
+// the end of each one (direct threading through computed goto on GCC/Clang,
+// a single switch elsewhere). Falls out to the caller at event boundaries,
+// i.e. HALT, a pending EI or a serviceable interrupt, where the post-step
+// interrupt handling of cpu_step() is applied. Returns instructions executed.
+#define BATCH_INST(op, type, mode, reg_1, reg_2, cond, param) \
+    static const instruction inst_##op = {type, mode, reg_1, reg_2, cond, param};
+
+#define BATCH_BOUNDARY(ctx) ((ctx)->halted || (ctx)->enabling_ime || \
+    ((ctx)->int_master_enabled && ((ctx)->int_flags & (ctx)->ie_register & 0x1F)))
+
+#define BATCH_FETCH(ctx) { \
+    (ctx)->cur_opcode = bus_fetch((ctx)->regs.pc++); \
+    (ctx)->cur_inst = instruction_by_opcode((ctx)->cur_opcode); \
+    emu_cycles(1); \
 }
+
+#if defined(__GNUC__)
+
+#define BATCH_LABEL_ENTRY(op, type, mode, reg_1, reg_2, cond, param) [op] = &&batch_##op,
+
+#define BATCH_NEXT(ctx) { \
+    steps++; \
+    if (BATCH_BOUNDARY(ctx) || steps >= max_steps) goto boundary; \
+    BATCH_FETCH(ctx) \
+    goto *labels[(ctx)->cur_opcode]; \
+}
+
+#define BATCH_HANDLER(op, type, mode, reg_1, reg_2, cond, param) \
+    batch_##op: inst_exec(ctx, &inst_##op); BATCH_NEXT(ctx)
+
+u32 cpu_exec_batch(cpu_context *ctx, u32 max_steps) {
+    INST_TABLE(BATCH_INST)
+
+    static void *labels[0x100] = {
+        INST_TABLE(BATCH_LABEL_ENTRY)
+    };
+
+    u32 steps = 0;
+
+    BATCH_FETCH(ctx)
+    goto *labels[ctx->cur_opcode];
+
+    INST_TABLE(BATCH_HANDLER)
+
+boundary:
+    cpu_complete_step(ctx);
+
+    return steps;
+}
+
+#else
+
+#define BATCH_CASE(op, type, mode, reg_1, reg_2, cond, param) \
+    case op: inst_exec(ctx, &inst_##op); break;
+
+u32 cpu_exec_batch(cpu_context *ctx, u32 max_steps) {
+    INST_TABLE(BATCH_INST)
+
+    u32 steps = 0;
+
+    do {
+        BATCH_FETCH(ctx)
+
+        switch(ctx->cur_opcode) {
+            INST_TABLE(BATCH_CASE)
+        }
+
+        steps++;
+    } while (!BATCH_BOUNDARY(ctx) && steps < max_steps);
+
+    cpu_complete_step(ctx);
+
+    return steps;
+}
+
+#endif
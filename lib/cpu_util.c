@@ -3,99 +3,100 @@
 
 extern cpu_context ctx;
 
-// Swaps the lo and hi bits of a 16-bit value
-u16 reverse(u16 n) {
-    return ((n & 0xFF00) >> 8) | ((n & 0x00FF) << 8);
+// Materialize Z/N/H/C from the last recorded ALU operation
+void cpu_flags_sync(cpu_context *ctx) {
+    int a = ctx->flag_a;
+    int b = ctx->flag_b;
+    int c = ctx->flag_c;
+    u8 r = ctx->flag_r;
+
+    bool z = r == 0;
+    bool n = false;
+    bool h = false;
+    bool cy = false;
+
+    switch(ctx->flag_op) {
+        case LF_NONE:
+            return;
+
+        case LF_ADD:
+            h = (a & 0xF) + (b & 0xF) + c > 0xF;
+            cy = a + b + c > 0xFF;
+            break;
+
+        case LF_SUB:
+            n = true;
+            h = (a & 0xF) - (b & 0xF) - c < 0;
+            cy = a - b - c < 0;
+            break;
+
+        case LF_AND:
+            h = true;
+            break;
+
+        case LF_OR:
+            break;
+
+        case LF_INC:
+            h = (r & 0x0F) == 0;
+            cy = c;
+            break;
+
+        case LF_DEC:
+            n = true;
+            h = (r & 0x0F) == 0x0F;
+            cy = c;
+            break;
+    }
+
+    ctx->regs.f = (ctx->regs.f & 0x0F) | (z << 7) | (n << 6) | (h << 5) | (cy << 4);
+    ctx->flag_op = LF_NONE;
 }
 
 // Return register value based on register type
 u16 cpu_read_reg(reg_type rt) {
-    switch(rt) {
-        case RT_A: return ctx.regs.a;
-        case RT_F: return ctx.regs.f;
-        case RT_B: return ctx.regs.b;
-        case RT_C: return ctx.regs.c;
-        case RT_D: return ctx.regs.d;
-        case RT_E: return ctx.regs.e;
-        case RT_H: return ctx.regs.h;
-        case RT_L: return ctx.regs.l;
-
-        case RT_AF: return reverse(*((u16 *)&ctx.regs.a));
-        case RT_BC: return reverse(*((u16 *)&ctx.regs.b));
-        case RT_DE: return reverse(*((u16 *)&ctx.regs.d));
-        case RT_HL: return reverse(*((u16 *)&ctx.regs.h));
-
-        case RT_PC: return ctx.regs.pc;
-        case RT_SP: return ctx.regs.sp;
-        default: return 0;
-    }
+    cpu_flags_sync(&ctx);
+    return cpu_regs_read(&ctx.regs, rt);
 }
 
 // Takes in register type and value, sets specified register to value
-// (take last 8 bits for 8-bit registers, reverse bits for 16-bit registers)
+// (take last 8 bits for 8-bit registers)
 void cpu_set_reg(reg_type rt, u16 val) {
-    switch(rt) {
-        case RT_A: ctx.regs.a = val & 0xFF; break;
-        case RT_F: ctx.regs.f = val & 0xFF; break;
-        case RT_B: ctx.regs.b = val & 0xFF; break;
-        case RT_C: {
-             ctx.regs.c = val & 0xFF;
-        } break;
-        case RT_D: ctx.regs.d = val & 0xFF; break;
-        case RT_E: ctx.regs.e = val & 0xFF; break;
-        case RT_H: ctx.regs.h = val & 0xFF; break;
-        case RT_L: ctx.regs.l = val & 0xFF; break;
-
-        case RT_AF: *((u16 *)&ctx.regs.a) = reverse(val); break;
-        case RT_BC: *((u16 *)&ctx.regs.b) = reverse(val); break;
-        case RT_DE: *((u16 *)&ctx.regs.d) = reverse(val); break;
-        case RT_HL: {
-         *((u16 *)&ctx.regs.h) = reverse(val); 
-         break;
-        }
-
-        case RT_PC: ctx.regs.pc = val; break;
-        case RT_SP: ctx.regs.sp = val; break;
-        case RT_NONE: break;
-    }
+    cpu_flags_sync(&ctx);
+    cpu_regs_set(&ctx.regs, rt, val);
 }
 
 // read register, specific for bitwise operations only
 u8 cpu_read_reg8(reg_type rt) {
-    switch(rt) {
-        case RT_A: return ctx.regs.a;
-        case RT_F: return ctx.regs.f;
-        case RT_B: return ctx.regs.b;
-        case RT_C: return ctx.regs.c;
-        case RT_D: return ctx.regs.d;
-        case RT_E: return ctx.regs.e;
-        case RT_H: return ctx.regs.h;
-        case RT_L: return ctx.regs.l;
-        case RT_HL: {
-            return bus_read(cpu_read_reg(RT_HL));
-        }
-        default:
-            printf("**ERR INVALID REG8: %d\n", rt);
-            NO_IMPL
+    cpu_flags_sync(&ctx);
+
+    if (rt == RT_HL) {
+        return bus_read(ctx.regs.hl);
+    }
+
+    if (!BETWEEN(rt, RT_A, RT_L)) {
+        printf("**ERR INVALID REG8: %d\n", rt);
+        NO_IMPL
     }
+
+    return ctx.regs.r8[REG8_INDEX(rt)];
 }
 
 // set register, specific for bitwise operations only
 void cpu_set_reg8(reg_type rt, u8 val) {
-    switch(rt) {
-        case RT_A: ctx.regs.a = val & 0xFF; break;
-        case RT_F: ctx.regs.f = val & 0xFF; break;
-        case RT_B: ctx.regs.b = val & 0xFF; break;
-        case RT_C: ctx.regs.c = val & 0xFF; break;
-        case RT_D: ctx.regs.d = val & 0xFF; break;
-        case RT_E: ctx.regs.e = val & 0xFF; break;
-        case RT_H: ctx.regs.h = val & 0xFF; break;
-        case RT_L: ctx.regs.l = val & 0xFF; break;
-        case RT_HL: bus_write(cpu_read_reg(RT_HL), val); break;
-        default:
-            printf("**ERR INVALID REG8: %d\n", rt);
-            NO_IMPL
+    cpu_flags_sync(&ctx);
+
+    if (rt == RT_HL) {
+        bus_write(ctx.regs.hl, val);
+        return;
     }
+
+    if (!BETWEEN(rt, RT_A, RT_L)) {
+        printf("**ERR INVALID REG8: %d\n", rt);
+        NO_IMPL
+    }
+
+    ctx.regs.r8[REG8_INDEX(rt)] = val;
 }
 
 cpu_registers *cpu_get_regs() {
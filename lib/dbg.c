@@ -1,25 +1,33 @@
 #include <dbg.h>
-#include <bus.h>
+#include <io.h>
 
 /*
     Debug messaging system for Blargg's tests
     Tests can be found here: https://gbdev.gg8.se/files/roms/blargg-gb-tests/
 */
 
-static char dbg_msg[1024] = {0};
-static int msg_size = 0;
+// Grown as needed, some tests print a lot more than a screen of text
+static char *dbg_msg = NULL;
+static u32 msg_size = 0;
+static u32 msg_capacity = 0;
 
-void dbg_update() {
-    if (bus_read(0xFF02) == 0x81) {
-        char c = bus_read(0xFF01);
-
-        dbg_msg[msg_size++] = c;
-        bus_write(0xFF02, 0);
+static void dbg_serial(u8 value) {
+    if (msg_size + 1 >= msg_capacity) {
+        msg_capacity = msg_capacity ? msg_capacity * 2 : 1024;
+        dbg_msg = realloc(dbg_msg, msg_capacity);
     }
+
+    dbg_msg[msg_size++] = value;
+    dbg_msg[msg_size] = 0;
+}
+
+// Capture everything the ROM sends out of the serial port
+void dbg_init() {
+    serial_set_callback(dbg_serial);
 }
 
 void dbg_print() {
-    if (dbg_msg[0]) {
-        // printf("DBG: %s\n", dbg_msg);
+    if (msg_size) {
+        printf("DBG: %s\n", dbg_msg);
     }
 }
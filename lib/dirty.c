@@ -0,0 +1,93 @@
+#include <dirty.h>
+#include <string.h>
+
+// The write paths mark blocks on the emulation thread while consumers such
+// as the debug view take them on the UI thread, so a flag is cleared in the
+// same step it is read, and a map is published only once it's complete
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DIRTY_CLEAR(p) ((u8)_InterlockedExchange8((volatile char *)(p), 0))
+#define DIRTY_NEXT_GEN(p) ((u32)_InterlockedIncrement((volatile long *)(p)))
+#define DIRTY_LOAD(p) (*(volatile u32 *)(p))
+#define DIRTY_STORE(p, v) (*(volatile u32 *)(p) = (v))
+#define DIRTY_PUBLISH(p, v) (*(u8 *volatile *)(p) = (v))
+#define DIRTY_PUBLISHED(p) (*(u8 *volatile *)(p))
+#else
+#define DIRTY_CLEAR(p) __atomic_exchange_n((p), 0, __ATOMIC_ACQ_REL)
+#define DIRTY_NEXT_GEN(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define DIRTY_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define DIRTY_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define DIRTY_PUBLISH(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define DIRTY_PUBLISHED(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+void dirty_init(dirty_map *map, u32 size, u8 shift) {
+    u32 count = (size + (1 << shift) - 1) >> shift;
+
+    map->shift = shift;
+
+    if (map->count == count) {
+        memset(map->blocks, 1, count);
+        return;
+    }
+
+    u8 *blocks = malloc(count);
+    memset(blocks, 1, count);
+
+    free(map->blocks);
+    free(map->gens);
+    map->gens = calloc(count, sizeof(u32));
+    map->count = count;
+    DIRTY_PUBLISH(&map->blocks, blocks);
+}
+
+bool dirty_ready(dirty_map *map) {
+    return DIRTY_PUBLISHED(&map->blocks) != NULL;
+}
+
+void dirty_view_init(dirty_view *view, dirty_map *map) {
+    if (view->count != map->count) {
+        free(view->seen);
+        view->seen = malloc(map->count * sizeof(u32));
+        view->count = map->count;
+    }
+
+    view->map = map;
+
+    // Generations start at 1, so 0 was never seen
+    memset(view->seen, 0, view->count * sizeof(u32));
+}
+
+bool dirty_take(dirty_view *view, u32 block) {
+    dirty_map *map = view->map;
+
+    if (view->count != map->count) {
+        dirty_view_init(view, map);
+    }
+
+    // Writes since the last fold make a new generation, a write landing
+    // right after the flag is cleared sets it again for the next look
+    if (DIRTY_CLEAR(&map->blocks[block])) {
+        DIRTY_STORE(&map->gens[block], DIRTY_NEXT_GEN(&map->gen));
+    }
+
+    u32 gen = DIRTY_LOAD(&map->gens[block]);
+
+    if (view->seen[block] == gen) {
+        return false;
+    }
+
+    view->seen[block] = gen;
+    return true;
+}
+
+u32 dirty_take_all(dirty_view *view, u8 *out) {
+    u32 changed = 0;
+
+    for (u32 i = 0; i < view->map->count; i++) {
+        out[i] = dirty_take(view, i);
+        changed += out[i];
+    }
+
+    return changed;
+}
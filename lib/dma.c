@@ -1,38 +1,101 @@
 #include <dma.h>
 #include <ppu.h>
 #include <bus.h>
+#include <sched.h>
+#include <emu.h>
 #include <unistd.h>
 
 typedef struct {
     bool active;
-    u8 byte;
-    u8 value;
-    u8 start_delay;
+    bool copied;        // the table is in OAM, waiting for the transfer time to pass
+    u8 value;           // source page, the value written to FF46
+    u64 start;          // tick the first byte is copied
 } dma_context;
 
 static dma_context ctx;
 
+// Reference: https://gbdev.io/pandocs/OAM_DMA_Transfer.html
+#define DMA_BYTES 0xA0
+
+// The DMA takes the bus its source is on for the whole transfer, VRAM has
+// a bus of its own and everything else shares one, so a CPU running from
+// HRAM is never in the way. OAM can't be read or written either.
+static void dma_hold_bus() {
+    bus_hold(0xFE00, 0x100, BUS_HOLD_DMA);
+
+    if (BETWEEN(ctx.value, 0x80, 0x9F)) {
+        bus_hold(0x8000, 0x2000, BUS_HOLD_DMA);
+    } else {
+        bus_hold(0x0000, 0x8000, BUS_HOLD_DMA);
+        bus_hold(0xA000, 0x5E00, BUS_HOLD_DMA);       // cart RAM, WRAM and echo RAM
+    }
+}
+
+// Move all 160 bytes at once, the CPU can't see OAM until the transfer
+// time is over anyway
+static void dma_copy() {
+    u16 source = ctx.value * 0x100;    // written value is transfer source divided by 0x100
+    u8 *page = bus_page(source);
+    u8 table[DMA_BYTES];
+
+    if (!page) {
+        // Not plain memory (echo RAM, disabled cart RAM), read it the slow
+        // way with the bus let go for a moment
+        bus_release(BUS_HOLD_DMA);
+
+        for (int i = 0; i < DMA_BYTES; i++) {
+            table[i] = bus_peek(source + i);
+        }
+
+        dma_hold_bus();
+        page = table;
+    }
+
+    ppu_oam_copy(page);
+}
+
+// The first byte is copied 3 M-cycles after the write to FF46, then one
+// byte every M-cycle
 void dma_start(u8 start) {
+    if (ctx.active) {
+        bus_release(BUS_HOLD_DMA);
+    }
+
     ctx.active = true;
-    ctx.byte = 0;
-    ctx.start_delay = 2;
+    ctx.copied = false;
     ctx.value = start;
+    ctx.start = emu_get_context()->ticks + 12;
+
+    dma_hold_bus();
+    sched_schedule(EV_DMA, ctx.start);
 }
-void dma_tick() {
-    if (!ctx.active) {
-        return;
-    }
 
-    if (ctx.start_delay) {
-        ctx.start_delay--;
+// Scheduled on the tick of the first byte, where the whole table is
+// copied, and on the tick of the last one, where the bus is let go
+void dma_event(u64 when) {
+    if (!ctx.copied) {
+        ppu_sync(when);
+        dma_copy();
+
+        ctx.copied = true;
+        sched_schedule(EV_DMA, when + (DMA_BYTES - 1) * 4);
         return;
     }
 
-    ppu_oam_write(ctx.byte, bus_read((ctx.value * 0x100) + ctx.byte)); // written value is transfer source divided by 0x1000
+    ctx.active = false;
+    bus_release(BUS_HOLD_DMA);
+}
+
+// The CPU reading from the bus the DMA holds sees the byte being moved,
+// OAM itself reads as 0xFF
+u8 dma_conflict_read(u16 address) {
+    if (address >= 0xFE00 || !ctx.copied) {
+        return 0xFF;
+    }
 
-    ctx.byte++;
+    u64 byte = (emu_get_context()->ticks - ctx.start) / 4;
 
-    ctx.active = ctx.byte < 0xA0; // if reached 0xA0, then we are done
+    return ppu_oam_read(byte < DMA_BYTES ? byte : DMA_BYTES - 1);
 }
 
 bool dma_transferring() {
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <emu.h>
 #include <cart.h>
 #include <cpu.h>
@@ -6,6 +7,12 @@
 #include <timer.h>
 #include <dma.h>
 #include <ppu.h>
+#include <idle.h>
+#include <sched.h>
+#include <dbg.h>
+#include <io.h>
+#include <ram.h>
+#include <watch.h>
 
 //TODO add windows alternative
 #include <pthread.h>
@@ -30,16 +37,18 @@ emu_context *emu_get_context() {
 }
 
 void *cpu_run(void *p) {
-    // Initialize CPU and timer
-    timer_init();
-    cpu_init();
-    ppu_init();
-
     // Setting initial context variables
     ctx.running = true;
     ctx.paused = false;
     ctx.ticks = 0;
 
+    // Initialize CPU and timer
+    sched_init();
+    ram_init();
+    timer_init();
+    cpu_init();
+    ppu_init();
+
     // Main game loop
     while (ctx.running) {
         if (ctx.paused) {
@@ -47,7 +56,11 @@ void *cpu_run(void *p) {
             continue;
         }
         
+#if CPU_THREADED || CPU_JIT
+        if (!cpu_run_batch(CPU_BATCH_STEPS)) {
+#else
         if (!cpu_step()) {
+#endif
             printf("CPU Stopped\n");
             return 0;
         }
@@ -59,7 +72,7 @@ void *cpu_run(void *p) {
 int emu_run(int argc, char **argv) {
     // Checks to see if a ROM file is passed in
     if (argc < 2) {
-        printf("Usage: emu <rom_file>\n");
+        printf("Usage: emu <rom_file> [-s] [-v] [-w <rwxp>:<start>[-<end>]]...\n");
         return -1;
     }
 
@@ -71,6 +84,33 @@ int emu_run(int argc, char **argv) {
 
     printf("Cart loaded..\n");
 
+    bool verbose = false;
+
+    for (int i = 2; i < argc; i++) {
+        // Draw whole scanlines instead of running the pixel FIFO
+        if (!strcmp(argv[i], "-s")) {
+            ppu_set_renderer(RENDER_SCANLINE);
+            continue;
+        }
+
+        // Print idle loop and I/O statistics on exit
+        if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+            continue;
+        }
+
+        // Watchpoints, P resumes after one pauses the emulator
+        if (!strcmp(argv[i], "-w") && i + 1 < argc && watch_parse(argv[i + 1]) >= 0) {
+            i++;
+            continue;
+        }
+
+        printf("Bad option: %s\n", argv[i]);
+        return -1;
+    }
+
+    dbg_init();
+
     ui_init();
 
     // Declare main thread
@@ -96,17 +136,48 @@ int emu_run(int argc, char **argv) {
         prev_frame = ppu_get_context()->current_frame;
     }
 
+    if (cart_need_save()) {
+        cart_battery_save();
+    }
+
+    dbg_print();
+
+    if (verbose) {
+        idle_stats *idle = idle_get_stats();
+        printf("%s: skipped %llu of %llu cycles in idle loops (%llu loops seen)\n", argv[1],
+            (unsigned long long)idle->cycles_skipped, (unsigned long long)(ctx.ticks / 4),
+            (unsigned long long)idle->loops_detected);
+        printf("%s: %llu accesses to unmapped I/O registers\n", argv[1],
+            (unsigned long long)io_unmapped_accesses());
+    }
+
     return 0;
 }
 
+// M-cycles that can pass before the next scheduled event, a halted CPU
+// or an idle loop skips over them in one step
+u32 emu_quiet_cycles() {
+    u64 ticks = sched_next_tick - ctx.ticks - 1;
+
+    if (ticks > UINT32_MAX) {
+        ticks = UINT32_MAX;
+    }
+
+    return ticks / 4;
+}
+
+// Advance the clock by cpu_cycles M-cycles at once, cpu_cycles must not
+// exceed emu_quiet_cycles()
+void emu_skip_cycles(u32 cpu_cycles) {
+    ctx.ticks += cpu_cycles * 4;
+}
+
+// Components catch up on their own when they are accessed, so only the
+// events that are now due have to run
 void emu_cycles(int cpu_cycles) {
-     for (int i = 0; i < cpu_cycles; i++) {
-        for (int n = 0; n < 4; n++) {
-            ctx.ticks++;
-            timer_tick();
-            ppu_tick();
-        }
+    ctx.ticks += cpu_cycles * 4;
 
-        dma_tick();
+    if (ctx.ticks >= sched_next_tick) {
+        sched_run(ctx.ticks);
     }
 }
@@ -0,0 +1,269 @@
+#include <idle.h>
+#include <bus.h>
+#include <emu.h>
+#include <watch.h>
+#include <ppu.h>
+#include <string.h>
+
+typedef struct {
+    u16 head;              // loop start, the jump target
+    u16 from;              // address just past the closing jump
+    bool pure;             // body passed the side effect check
+    bool reads_stat;       // body reads STAT, whose mode bits change without an event
+    bool seen;             // regs and visit_ticks hold a previous pass
+    cpu_registers regs;    // registers at the previous pass
+    u64 visit_ticks;       // emulator ticks at the previous pass
+    u64 quiet_until;       // no event can happen before this tick
+    idle_stats stats;
+} idle_context;
+
+static idle_context ctx;
+
+idle_stats *idle_get_stats() {
+    return &ctx.stats;
+}
+
+// Memory that only changes on a CPU write or a timer, PPU or DMA event,
+// or for STAT on a PPU mode change, which idle_quiet_cycles waits for
+static bool idle_addr_stable(u16 address) {
+    if (address < 0xA000) {                               // ROM and VRAM
+        return true;
+    }
+
+    if (address >= 0xC000 && address < 0xFEA0) {         // WRAM, echo RAM and OAM
+        return true;
+    }
+
+    if (address >= 0xFF80) {                              // HRAM and IE
+        return true;
+    }
+
+    // IF, STAT and LY
+    return address == 0xFF0F || address == 0xFF41 || address == 0xFF44;
+}
+
+// Address read through a register operand, (C) reads from 0xFF00 + C
+static u16 idle_reg_addr(cpu_context *cpu, reg_type rt) {
+    u16 address = cpu_regs_read(&cpu->regs, rt);
+
+    if (rt == RT_C) {
+        address |= 0xFF00;
+    }
+
+    return address;
+}
+
+// Decode the loop body and check that a pass only writes A and F and only
+// reads memory that stays the same until the next event. Only A is ever
+// written so the addresses read through BC, DE and HL are the current ones.
+static bool idle_body_pure(cpu_context *cpu, u16 head, u16 from, bool *reads_stat) {
+    u16 addr = head;
+    bool jump = false;
+    bool stat = false;
+
+    // Until the whole body checks out, assume the worst
+    *reads_stat = true;
+
+    while (addr < from) {
+        // Skipped passes would never reach a watchpoint
+        if (watch_pages[addr >> 8]) {
+            return false;
+        }
+
+        instruction *inst = instruction_by_opcode(bus_peek(addr));
+        u16 next = addr + inst_length(inst->mode);
+        bool reads = false;
+        u16 read = 0;
+
+        jump = false;
+
+        switch(inst->type) {
+            case IN_NOP:
+                break;
+
+            case IN_LD:
+            case IN_LDH:
+                if (inst->reg_1 != RT_A) {
+                    return false;
+                }
+
+                switch(inst->mode) {
+                    case AM_R_R:
+                    case AM_R_D8:
+                        break;
+
+                    case AM_R_MR:
+                        reads = true;
+                        read = idle_reg_addr(cpu, inst->reg_2);
+                        break;
+
+                    case AM_R_A8:
+                        reads = true;
+                        read = 0xFF00 | bus_peek(addr + 1);
+                        break;
+
+                    case AM_R_A16:
+                        reads = true;
+                        read = bus_peek(addr + 1) | (bus_peek(addr + 2) << 8);
+                        break;
+
+                    default:
+                        return false;
+                }
+                break;
+
+            case IN_ADD:
+            case IN_ADC:
+            case IN_SUB:
+            case IN_SBC:
+            case IN_AND:
+            case IN_XOR:
+            case IN_OR:
+            case IN_CP:
+                if (inst->reg_1 != RT_A) {
+                    return false;
+                }
+
+                if (inst->mode == AM_R_MR) {
+                    reads = true;
+                    read = idle_reg_addr(cpu, inst->reg_2);
+                } else if (inst->mode != AM_R_R && inst->mode != AM_R_D8) {
+                    return false;
+                }
+                break;
+
+            case IN_INC:
+            case IN_DEC:
+                if (inst->mode != AM_R || inst->reg_1 != RT_A) {
+                    return false;
+                }
+                break;
+
+            case IN_CB: {
+                u8 op = bus_peek(addr + 1);
+
+                if ((op & 0xC0) != 0x40) {                // only BIT n, r
+                    return false;
+                }
+
+                if ((op & 7) == 6) {                      // BIT n, (HL)
+                    reads = true;
+                    read = cpu->regs.hl;
+                }
+                break;
+            }
+
+            case IN_JR:
+            case IN_JP: {
+                u16 target;
+
+                if (inst->mode == AM_D8) {
+                    target = next + (char)bus_peek(addr + 1);
+                } else if (inst->mode == AM_D16) {
+                    target = bus_peek(addr + 1) | (bus_peek(addr + 2) << 8);
+                } else {
+                    return false;
+                }
+
+                // a jump before the end has to be a conditional exit
+                if (next != from && (inst->cond == CT_NONE ||
+                        (target >= head && target < from))) {
+                    return false;
+                }
+
+                jump = true;
+                break;
+            }
+
+            default:
+                return false;
+        }
+
+        if (reads && (!idle_addr_stable(read) || watch_pages[read >> 8])) {
+            return false;
+        }
+
+        if (reads && read == 0xFF41) {
+            stat = true;
+        }
+
+        addr = next;
+    }
+
+    *reads_stat = stat;
+    return addr == from && jump;
+}
+
+// M-cycles that can pass before the next event, or before the next PPU
+// mode change for loops polling STAT
+static u32 idle_quiet_cycles() {
+    u32 quiet = emu_quiet_cycles();
+
+    if (ctx.reads_stat) {
+        u64 stat = (ppu_stat_change() - emu_get_context()->ticks - 1) / 4;
+
+        if (stat < quiet) {
+            quiet = stat;
+        }
+    }
+
+    return quiet;
+}
+
+void idle_loop(cpu_context *cpu, u16 from) {
+    u16 head = cpu->regs.pc;
+
+    if (from - head > IDLE_MAX_LOOP_BYTES) {
+        return;
+    }
+
+    if (head != ctx.head || from != ctx.from) {
+        ctx.head = head;
+        ctx.from = from;
+        ctx.seen = false;
+        ctx.pure = idle_body_pure(cpu, head, from, &ctx.reads_stat);
+
+        if (ctx.pure) {
+            ctx.stats.loops_detected++;
+        }
+    }
+
+    if (!ctx.pure) {
+        return;
+    }
+
+    emu_context *emu = emu_get_context();
+
+    cpu_flags_sync(cpu);
+
+    // An interrupt serviced now would run in the middle of the next pass
+    bool interrupt = cpu->enabling_ime ||
+        (cpu->int_master_enabled && (cpu->int_flags & cpu->ie_register & 0x1F));
+
+    // No body instruction takes more than 2 M-cycles per byte, a longer
+    // pass left the loop and came back
+    u32 period = (emu->ticks - ctx.visit_ticks) / 4;
+
+    // The last pass started and ended with the same registers and saw no
+    // event, so every pass until the next event will do the same. The body
+    // is checked again since the code or the registers it reads through
+    // may have changed since the loop was first seen.
+    if (ctx.seen && !interrupt && emu->ticks <= ctx.quiet_until &&
+            period <= 2 * (u32)(from - head) &&
+            !memcmp(&ctx.regs, &cpu->regs, sizeof(cpu_registers)) &&
+            idle_body_pure(cpu, head, from, &ctx.reads_stat)) {
+        u32 passes = idle_quiet_cycles() / period;
+
+        if (passes) {
+            emu_skip_cycles(passes * period);
+
+            ctx.stats.loops_skipped++;
+            ctx.stats.cycles_skipped += passes * period;
+        }
+    }
+
+    ctx.seen = !interrupt;
+    ctx.regs = cpu->regs;
+    ctx.visit_ticks = emu->ticks;
+    ctx.quiet_until = emu->ticks + idle_quiet_cycles() * 4;
+}
@@ -4,7 +4,7 @@
 
 // Handle interrupts
 void int_handle(cpu_context *ctx, u16 address) {
-    stack_push16(ctx->regs.pc);
+    stack_push16_cycles(ctx, ctx->regs.pc, 0);
     ctx->regs.pc = address;
 }
 
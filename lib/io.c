@@ -4,85 +4,198 @@
 #include <dma.h>
 #include <lcd.h>
 #include <gamepad.h>
+#include <interrupts.h>
+#include <sched.h>
+#include <emu.h>
 
 /*
     Handling Serial Data Transfer (I/O)
     Reference: https://gbdev.io/pandocs/Serial_Data_Transfer_(Link_Cable).html
 */
 
-static char serial_data[2];
+static u8 serial_data[2];
+static serial_callback serial_cb;
 
-u8 io_read(u16 address) {
-    if (address == 0xFF00) {
-        return gamepad_get_output();
+void serial_set_callback(serial_callback callback) {
+    serial_cb = callback;
+}
+
+// Ticks to shift out 8 bits on the internal 8192 Hz clock
+#define SERIAL_TRANSFER_TICKS (8 * 512)
+
+// Scheduled when a transfer started on the internal clock completes. With
+// no link partner every bit shifted in is 1.
+void serial_event(u64 when) {
+    if (!(serial_data[1] & 0x80)) {
+        return;     // transfer was cancelled
     }
 
+    serial_data[0] = 0xFF;
+    serial_data[1] &= ~0x80;
+    cpu_request_interrupt(IT_SERIAL);
+}
+
+static u8 serial_read(u16 address) {
+    return serial_data[address & 1 ? 0 : 1];
+}
+
+static void serial_write(u16 address, u8 value) {
     if (address == 0xFF01) {
-        return serial_data[0];
+        serial_data[0] = value;
+        return;
     }
 
-    if (address == 0xFF02) {
-        return serial_data[1];
-    }
+    serial_data[1] = value;
 
-    if (BETWEEN(address, 0xFF04, 0xFF07)) {
-        return timer_read(address);
-    }
+    if ((value & 0x81) == 0x81) {
+        if (serial_cb) {
+            serial_cb(serial_data[0]);
+        }
 
-    // Interrupt flag: https://gbdev.io/pandocs/Interrupts.html#ff0f--if-interrupt-flag
-    if (address == 0xFF0F) {
-        return cpu_get_int_flags();
+        sched_schedule(EV_SERIAL, emu_get_context()->ticks + SERIAL_TRANSFER_TICKS);
     }
+}
 
-    // Ignoring audio for now...
-    if (BETWEEN(address, 0xFF10, 0xFF3F)) {
-        return 0;
-    }
+static u8 joypad_read(u16 address) {
+    return gamepad_get_output();
+}
 
-    if (BETWEEN(address, 0xFF40, 0xFF4B)) {
-        return lcd_read(address);
-    }
+static void joypad_write(u16 address, u8 value) {
+    gamepad_set_sel(value);
+}
 
-    printf("UNSUPPORTED bus_read(%04X)\n", address);
-    return 0;
+// Interrupt flag: https://gbdev.io/pandocs/Interrupts.html#ff0f--if-interrupt-flag
+static u8 if_read(u16 address) {
+    return cpu_get_int_flags();
 }
 
-void io_write(u16 address, u8 value) {
-    if (address == 0xFF00) {
-        gamepad_set_sel(value);
-        return;
-    }
+static void if_write(u16 address, u8 value) {
+    cpu_set_int_flags(value);
+}
 
-    if (address == 0xFF01) {
-        serial_data[0] = value;
-        return;
-    }
+/*
+    I/O register table for FF00-FF7F
+    Reference: https://gbdev.io/pandocs/Hardware_Reg_List.html
 
-    if (address == 0xFF02) {
-        serial_data[1] = value;
-        return;
-    }
+    Writes only change the bits in write_mask, a register without any is
+    read-only and handlers never see the other bits. Bits in read_mask
+    always read as 1. Registers without handlers are plain storage in
+    io_regs, which covers the audio registers until there is sound.
+*/
 
-    if (BETWEEN(address, 0xFF04, 0xFF07)) {
-        timer_write(address, value);
-        return;
+typedef struct {
+    bool present;
+    u8 (*read)(u16 address);
+    void (*write)(u16 address, u8 value);
+    u8 write_mask;
+    u8 read_mask;
+} io_register;
+
+#define IO_REG(read, write, write_mask, read_mask) {true, read, write, write_mask, read_mask}
+#define IO_PLAIN(write_mask, read_mask) IO_REG(NULL, NULL, write_mask, read_mask)
+
+static const io_register io_registers[0x80] = {
+    [0x00] = IO_REG(joypad_read, joypad_write, 0x30, 0xC0),      // JOYP
+    [0x01] = IO_REG(serial_read, serial_write, 0xFF, 0x00),      // SB
+    [0x02] = IO_REG(serial_read, serial_write, 0x81, 0x7E),      // SC
+    [0x04] = IO_REG(timer_read, timer_write, 0xFF, 0x00),        // DIV, any write resets it
+    [0x05] = IO_REG(timer_read, timer_write, 0xFF, 0x00),        // TIMA
+    [0x06] = IO_REG(timer_read, timer_write, 0xFF, 0x00),        // TMA
+    [0x07] = IO_REG(timer_read, timer_write, 0x07, 0xF8),        // TAC
+    [0x0F] = IO_REG(if_read, if_write, 0x1F, 0xE0),              // IF
+
+    [0x10] = IO_PLAIN(0x7F, 0x80),                               // NR10
+    [0x11] = IO_PLAIN(0xFF, 0x3F),                               // NR11
+    [0x12] = IO_PLAIN(0xFF, 0x00),                               // NR12
+    [0x13] = IO_PLAIN(0xFF, 0xFF),                               // NR13
+    [0x14] = IO_PLAIN(0xC7, 0xBF),                               // NR14
+    [0x16] = IO_PLAIN(0xFF, 0x3F),                               // NR21
+    [0x17] = IO_PLAIN(0xFF, 0x00),                               // NR22
+    [0x18] = IO_PLAIN(0xFF, 0xFF),                               // NR23
+    [0x19] = IO_PLAIN(0xC7, 0xBF),                               // NR24
+    [0x1A] = IO_PLAIN(0x80, 0x7F),                               // NR30
+    [0x1B] = IO_PLAIN(0xFF, 0xFF),                               // NR31
+    [0x1C] = IO_PLAIN(0x60, 0x9F),                               // NR32
+    [0x1D] = IO_PLAIN(0xFF, 0xFF),                               // NR33
+    [0x1E] = IO_PLAIN(0xC7, 0xBF),                               // NR34
+    [0x20] = IO_PLAIN(0x3F, 0xFF),                               // NR41
+    [0x21] = IO_PLAIN(0xFF, 0x00),                               // NR42
+    [0x22] = IO_PLAIN(0xFF, 0x00),                               // NR43
+    [0x23] = IO_PLAIN(0xC0, 0xBF),                               // NR44
+    [0x24] = IO_PLAIN(0xFF, 0x00),                               // NR50
+    [0x25] = IO_PLAIN(0xFF, 0x00),                               // NR51
+    [0x26] = IO_PLAIN(0x80, 0x70),                               // NR52, no channel is ever playing
+
+    // Wave RAM
+    [0x30] = IO_PLAIN(0xFF, 0x00), [0x31] = IO_PLAIN(0xFF, 0x00),
+    [0x32] = IO_PLAIN(0xFF, 0x00), [0x33] = IO_PLAIN(0xFF, 0x00),
+    [0x34] = IO_PLAIN(0xFF, 0x00), [0x35] = IO_PLAIN(0xFF, 0x00),
+    [0x36] = IO_PLAIN(0xFF, 0x00), [0x37] = IO_PLAIN(0xFF, 0x00),
+    [0x38] = IO_PLAIN(0xFF, 0x00), [0x39] = IO_PLAIN(0xFF, 0x00),
+    [0x3A] = IO_PLAIN(0xFF, 0x00), [0x3B] = IO_PLAIN(0xFF, 0x00),
+    [0x3C] = IO_PLAIN(0xFF, 0x00), [0x3D] = IO_PLAIN(0xFF, 0x00),
+    [0x3E] = IO_PLAIN(0xFF, 0x00), [0x3F] = IO_PLAIN(0xFF, 0x00),
+
+    [0x40] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // LCDC
+    [0x41] = IO_REG(lcd_read, lcd_write, 0x78, 0x80),            // STAT, mode and LYC flag are read-only
+    [0x42] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // SCY
+    [0x43] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // SCX
+    [0x44] = IO_REG(lcd_read, lcd_write, 0x00, 0x00),            // LY
+    [0x45] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // LYC
+    [0x46] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // DMA
+    [0x47] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // BGP
+    [0x48] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // OBP0
+    [0x49] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // OBP1
+    [0x4A] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // WY
+    [0x4B] = IO_REG(lcd_read, lcd_write, 0xFF, 0x00),            // WX
+};
+
+// Backing store of the registers without handlers, at their values after
+// the boot ROM
+static u8 io_regs[0x80] = {
+    [0x10] = 0x80, [0x11] = 0xBF, [0x12] = 0xF3, [0x14] = 0xBF,
+    [0x16] = 0x3F, [0x19] = 0xBF, [0x1A] = 0x7F, [0x1B] = 0xFF,
+    [0x1C] = 0x9F, [0x1E] = 0xBF, [0x20] = 0xFF, [0x23] = 0xBF,
+    [0x24] = 0x77, [0x25] = 0xF3, [0x26] = 0x80,
+};
+
+static u64 unmapped_accesses;
+
+u64 io_unmapped_accesses() {
+    return unmapped_accesses;
+}
+
+// Registers that don't exist on the DMG read as open bus
+u8 io_read(u16 address) {
+    const io_register *reg = &io_registers[address & 0x7F];
+
+    if (!reg->present) {
+        unmapped_accesses++;
+        return 0xFF;
     }
 
-    // Interrupt flag: https://gbdev.io/pandocs/Interrupts.html#ff0f--if-interrupt-flag
-    if (address == 0xFF0F) {
-        cpu_set_int_flags(value);
+    u8 value = reg->read ? reg->read(address) : io_regs[address & 0x7F];
+
+    return value | reg->read_mask;
+}
+
+void io_write(u16 address, u8 value) {
+    const io_register *reg = &io_registers[address & 0x7F];
+
+    if (!reg->present) {
+        unmapped_accesses++;
         return;
     }
 
-    // Ignoring audio for now...
-    if (BETWEEN(address, 0xFF10, 0xFF3F)) {
+    if (!reg->write_mask) {
         return;
     }
 
-    if (BETWEEN(address, 0xFF40, 0xFF4B)) {
-        lcd_write(address, value);
+    if (reg->write) {
+        reg->write(address, value & reg->write_mask);
         return;
     }
 
-    printf("UNSUPPORTED bus_write(%04X)\n", address);
+    u8 *p = &io_regs[address & 0x7F];
+    *p = (*p & ~reg->write_mask) | (value & reg->write_mask);
 }
@@ -0,0 +1,683 @@
+#include <jit.h>
+#include <bus.h>
+#include <emu.h>
+#include <watch.h>
+#include <dma.h>
+#include <string.h>
+
+/*
+    SM83 to x86-64 block translator
+
+    Blocks are plain functions, u32 block(cpu_context *ctx), returning the
+    number of instructions they ran. rbx holds the cpu context and r12 the
+    flag conversion table for the whole block. Each instruction ticks the
+    bus just as cpu_step() does, then the block returns early on any of the
+    events the batch loop stops for: HALT, a pending EI, an interrupt ready
+    to be serviced, or a write that invalidated translated code.
+
+    Native code reads and writes F directly, so it never runs with flags
+    deferred by the processors (see cpu_defer_flags()).
+*/
+
+u8 jit_ram_code[0x4000];
+
+#if CPU_JIT && defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+typedef u32 (*jit_block)(cpu_context *);
+
+// Source range of a block translated from RAM
+typedef struct {
+    u16 start;
+    u16 end;
+} jit_ram_block;
+
+#define JIT_MAX_RAM_BLOCKS 0x400
+
+typedef struct {
+    u8 *code;                  // executable buffer
+    u8 *emit;                  // next free byte in the buffer
+
+    jit_block rom0[0x4000];    // blocks in 0000-3FFF
+    u16 rom0_bank;             // bank currently mapped at 0000-3FFF
+    jit_block *romx[0x200];    // blocks in 4000-7FFF, one table per ROM bank
+    u16 rom_bank;              // bank currently mapped at 4000-7FFF
+    jit_block ram[0x4000];     // blocks in WRAM and HRAM, indexed by address - 0xC000
+    jit_ram_block ram_blocks[JIT_MAX_RAM_BLOCKS];
+    u32 ram_block_count;
+
+    bool dirty;                // set when the running block's code may be stale
+    u8 flag_lut[0x100];        // x86 flags from LAHF to Z/H/C flag bits
+
+    jit_stats stats;
+} jit_context;
+
+static jit_context ctx = {
+    .rom_bank = 1
+};
+
+// Worst case size of one translated block, the buffer is flushed if a
+// block this big wouldn't fit
+#define JIT_BLOCK_MAX_BYTES (JIT_MAX_BLOCK_INSTS * 160 + 64)
+
+#define CTX_OFF(field) ((u32)offsetof(cpu_context, field))
+
+static void emit8(u8 b) {
+    *ctx.emit++ = b;
+}
+
+static void emit16(u16 v) {
+    memcpy(ctx.emit, &v, 2);
+    ctx.emit += 2;
+}
+
+static void emit32(u32 v) {
+    memcpy(ctx.emit, &v, 4);
+    ctx.emit += 4;
+}
+
+static void emit64(u64 v) {
+    memcpy(ctx.emit, &v, 8);
+    ctx.emit += 8;
+}
+
+// Emit op with a [rbx + disp32] memory operand, reg is the ModRM reg field
+static void emit_ctx_op(u8 op, u8 reg, u32 off) {
+    emit8(op);
+    emit8(0x80 | (reg << 3) | 3);
+    emit32(off);
+}
+
+// jcc rel32, returns the displacement to patch once the target is known
+static u8 *emit_jcc(u8 cc) {
+    emit8(0x0F);
+    emit8(cc);
+    emit32(0);
+    return ctx.emit - 4;
+}
+
+static void patch_jump(u8 *disp) {
+    u32 rel = (u32)(ctx.emit - (disp + 4));
+    memcpy(disp, &rel, 4);
+}
+
+// mov rax, fn; call rax
+static void emit_call(void *fn) {
+    emit8(0x48);
+    emit8(0xB8);
+    emit64((u64)fn);
+    emit8(0xFF);
+    emit8(0xD0);
+}
+
+static void emit_prologue() {
+    emit8(0x53);                               // push rbx
+    emit8(0x41); emit8(0x54);                  // push r12
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);  // sub rsp, 8
+    emit8(0x48); emit8(0x89); emit8(0xFB);     // mov rbx, rdi
+    emit8(0x49); emit8(0xBC);                  // mov r12, flag_lut
+    emit64((u64)ctx.flag_lut);
+}
+
+// Return count from the block, a next_pc of -1 leaves pc as the
+// processor set it
+static void emit_exit(u32 count, int next_pc) {
+    if (next_pc >= 0) {
+        emit8(0x66);
+        emit_ctx_op(0xC7, 0, CTX_OFF(regs.pc));
+        emit16(next_pc);
+    }
+
+    emit8(0xB8);                               // mov eax, count
+    emit32(count);
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);  // add rsp, 8
+    emit8(0x41); emit8(0x5C);                  // pop r12
+    emit8(0x5B);                               // pop rbx
+    emit8(0xC3);                               // ret
+}
+
+static void emit_cycles(int cycles) {
+    emit8(0xBF);                               // mov edi, cycles
+    emit32(cycles);
+    emit_call(emu_cycles);
+}
+
+// Leave the block if an interrupt is ready to be serviced, native
+// instructions can only raise one through the cycles they ticked
+static void emit_check_irq(u32 count, int next_pc) {
+    emit_ctx_op(0xF6, 0, CTX_OFF(int_master_enabled));   // test byte [ime], 1
+    emit8(1);
+    u8 *no_ime = emit_jcc(0x84);
+
+    emit_ctx_op(0x8A, 0, CTX_OFF(int_flags));            // mov al, [if]
+    emit_ctx_op(0x22, 0, CTX_OFF(ie_register));          // and al, [ie]
+    emit8(0xA8);                                          // test al, 0x1F
+    emit8(0x1F);
+    u8 *none = emit_jcc(0x84);
+
+    emit_exit(count, next_pc);
+    patch_jump(no_ime);
+    patch_jump(none);
+}
+
+// After a processor call also leave on HALT, EI or invalidated code
+static void emit_check_events(u32 count) {
+    emit_ctx_op(0x8A, 0, CTX_OFF(halted));               // mov al, [halted]
+    emit_ctx_op(0x0A, 0, CTX_OFF(enabling_ime));         // or al, [enabling_ime]
+    emit8(0x48); emit8(0xBA);                             // mov rdx, &dirty
+    emit64((u64)&ctx.dirty);
+    emit8(0x0A); emit8(0x02);                             // or al, [rdx]
+    u8 *event = emit_jcc(0x85);
+
+    emit_ctx_op(0xF6, 0, CTX_OFF(int_master_enabled));
+    emit8(1);
+    u8 *no_ime = emit_jcc(0x84);
+
+    emit_ctx_op(0x8A, 0, CTX_OFF(int_flags));
+    emit_ctx_op(0x22, 0, CTX_OFF(ie_register));
+    emit8(0xA8);
+    emit8(0x1F);
+    u8 *none = emit_jcc(0x84);
+
+    patch_jump(event);
+    emit_exit(count, -1);
+    patch_jump(no_ime);
+    patch_jump(none);
+}
+
+static bool is_16_bit(reg_type rt) {
+    return rt >= RT_AF;
+}
+
+static u32 reg8_off(reg_type rt) {
+    return CTX_OFF(regs.r8) + REG8_INDEX(rt);
+}
+
+// Register pairs are host-order u16s, same as x86
+static u32 reg16_off(reg_type rt) {
+    return CTX_OFF(regs.r16) + (rt - RT_AF) * 2;
+}
+
+// Merge the flag bits in cl into F, keep selects the F bits left alone
+static void emit_store_flags(u8 keep) {
+    emit_ctx_op(0x8A, 2, CTX_OFF(regs.f));   // mov dl, [f]
+    emit8(0x80); emit8(0xE2); emit8(keep);   // and dl, keep
+    emit8(0x08); emit8(0xCA);                // or dl, cl
+    emit_ctx_op(0x88, 2, CTX_OFF(regs.f));   // mov [f], dl
+}
+
+// cl = Z/H/C from the host flags saved in ah
+static void emit_lahf_flags() {
+    emit8(0x0F); emit8(0xB6); emit8(0xCC);               // movzx ecx, ah
+    emit8(0x41); emit8(0x0F); emit8(0xB6); emit8(0x0C); emit8(0x0C);  // movzx ecx, byte [r12+rcx]
+}
+
+// Byte operands in the x86 ALU encoding order: [rbx+disp32] form, imm8 form
+static const u8 alu_ops[][2] = {
+    [IN_ADD] = {0x02, 0x04},
+    [IN_ADC] = {0x12, 0x14},
+    [IN_SUB] = {0x2A, 0x2C},
+    [IN_SBC] = {0x1A, 0x1C},
+    [IN_AND] = {0x22, 0x24},
+    [IN_XOR] = {0x32, 0x34},
+    [IN_OR]  = {0x0A, 0x0C},
+    [IN_CP]  = {0x3A, 0x3C},
+};
+
+// 8-bit ALU on A with a register or immediate operand
+static void emit_alu(in_type type, bool imm, u32 src, u8 d8) {
+    emit_ctx_op(0x8A, 0, CTX_OFF(regs.a));   // mov al, [a]
+
+    if (type == IN_ADC || type == IN_SBC) {
+        emit_ctx_op(0x8A, 2, CTX_OFF(regs.f));   // mov dl, [f]
+        emit8(0x0F); emit8(0xBA); emit8(0xE2); emit8(4);  // bt edx, 4 (carry in)
+    }
+
+    if (imm) {
+        emit8(alu_ops[type][1]);
+        emit8(d8);
+    } else {
+        emit_ctx_op(alu_ops[type][0], 0, src);
+    }
+
+    if (type == IN_AND || type == IN_XOR || type == IN_OR) {
+        // Host AF is undefined for logic ops, Z comes from the result
+        emit_ctx_op(0x88, 0, CTX_OFF(regs.a));   // mov [a], al
+        emit8(0x84); emit8(0xC0);                // test al, al
+        emit8(0x0F); emit8(0x94); emit8(0xC1);   // setz cl
+        emit8(0xC0); emit8(0xE1); emit8(7);      // shl cl, 7
+
+        if (type == IN_AND) {
+            emit8(0x80); emit8(0xC9); emit8(0x20);   // or cl, H
+        }
+
+        emit_store_flags(0x0F);
+        return;
+    }
+
+    emit8(0x9F);                                 // lahf
+
+    if (type != IN_CP) {
+        emit_ctx_op(0x88, 0, CTX_OFF(regs.a));   // mov [a], al
+    }
+
+    emit_lahf_flags();
+
+    if (type == IN_SUB || type == IN_SBC || type == IN_CP) {
+        emit8(0x80); emit8(0xC9); emit8(0x40);   // or cl, N
+    }
+
+    emit_store_flags(0x0F);
+}
+
+// INC r / DEC r, C is left untouched
+static void emit_incdec8(bool dec, u32 off) {
+    emit_ctx_op(0xFE, dec ? 1 : 0, off);         // inc/dec byte [r]
+    emit8(0x9F);                                 // lahf
+    emit_lahf_flags();
+    emit8(0x80); emit8(0xE1); emit8(0xA0);       // and cl, Z|H
+
+    if (dec) {
+        emit8(0x80); emit8(0xC9); emit8(0x40);   // or cl, N
+    }
+
+    emit_store_flags(0x1F);
+}
+
+// INC rr / DEC rr, no flags
+static void emit_incdec16(bool dec, reg_type rt) {
+    emit8(0x66);
+    emit_ctx_op(0xFF, dec ? 1 : 0, reg16_off(rt));   // inc/dec word [rr]
+}
+
+// Instructions that change control flow or stop the CPU end a block
+static bool ends_block(in_type type) {
+    switch(type) {
+        case IN_NONE:
+        case IN_JP:
+        case IN_JR:
+        case IN_CALL:
+        case IN_RET:
+        case IN_RETI:
+        case IN_RST:
+        case IN_HALT:
+        case IN_STOP:
+        case IN_EI:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Instructions whose processors record flags with cpu_defer_flags()
+static bool defers_flags(in_type type) {
+    switch(type) {
+        case IN_ADD:
+        case IN_ADC:
+        case IN_SUB:
+        case IN_SBC:
+        case IN_AND:
+        case IN_XOR:
+        case IN_OR:
+        case IN_CP:
+        case IN_INC:
+        case IN_DEC:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Translate a register only instruction to native code, returns false if
+// it needs the processor
+static bool emit_native(const instruction *inst, u16 addr, u32 count) {
+    u16 next = addr + inst_length(inst->mode);
+    int cycles = 1;
+
+    switch(inst->type) {
+        case IN_NOP:
+            break;
+
+        case IN_LD:
+            if (inst->mode == AM_R_R && !is_16_bit(inst->reg_1) && !is_16_bit(inst->reg_2)) {
+                emit_ctx_op(0x8A, 0, reg8_off(inst->reg_2));   // mov al, [src]
+                emit_ctx_op(0x88, 0, reg8_off(inst->reg_1));   // mov [dst], al
+            } else if (inst->mode == AM_R_D8) {
+                emit_ctx_op(0xC6, 0, reg8_off(inst->reg_1));   // mov byte [dst], d8
+                emit8(bus_peek(addr + 1));
+                cycles = 2;
+            } else if (inst->mode == AM_R_D16) {
+                emit8(0x66);
+                emit_ctx_op(0xC7, 0, reg16_off(inst->reg_1));  // mov word [rr], d16
+                emit16(bus_peek(addr + 1) | (bus_peek(addr + 2) << 8));
+
+                cycles = 3;
+            } else {
+                return false;
+            }
+            break;
+
+        case IN_INC:
+        case IN_DEC:
+            if (inst->mode != AM_R) {
+                return false;
+            }
+
+            if (is_16_bit(inst->reg_1)) {
+                emit_incdec16(inst->type == IN_DEC, inst->reg_1);
+                cycles = 2;
+            } else {
+                emit_incdec8(inst->type == IN_DEC, reg8_off(inst->reg_1));
+            }
+            break;
+
+        case IN_ADD:
+        case IN_ADC:
+        case IN_SUB:
+        case IN_SBC:
+        case IN_AND:
+        case IN_XOR:
+        case IN_OR:
+        case IN_CP:
+            if (inst->reg_1 != RT_A) {
+                return false;
+            }
+
+            if (inst->mode == AM_R_R && !is_16_bit(inst->reg_2)) {
+                emit_alu(inst->type, false, reg8_off(inst->reg_2), 0);
+            } else if (inst->mode == AM_R_D8) {
+                emit_alu(inst->type, true, 0, bus_peek(addr + 1));
+                cycles = 2;
+            } else {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    emit_cycles(cycles);
+    emit_check_irq(count, next);
+    return true;
+}
+
+// Call the opcode's processor, fetching operands through the bus as usual
+static void emit_processor(u8 op, const instruction *inst, u16 addr, u32 count) {
+    emit8(0x66);
+    emit_ctx_op(0xC7, 0, CTX_OFF(regs.pc));      // mov word [pc], addr + 1
+    emit16(addr + 1);
+    emit_ctx_op(0xC6, 0, CTX_OFF(cur_opcode));   // mov byte [cur_opcode], op
+    emit8(op);
+
+    emit_cycles(1);
+
+    emit8(0x48); emit8(0x89); emit8(0xDF);       // mov rdi, rbx
+    emit_call(inst_processors[op]);
+
+    // Native code works on F directly, so flags the processor deferred
+    // are computed straight away
+    if (defers_flags(inst->type)) {
+        emit8(0x48); emit8(0x89); emit8(0xDF);
+        emit_call(cpu_flags_sync);
+    }
+
+    if (!ends_block(inst->type)) {
+        emit_check_events(count);
+    }
+}
+
+// Returns the end of the code region containing pc, or 0 if blocks
+// can't be translated from there
+static u32 region_end(u16 pc) {
+    if (pc < 0x4000) {
+        return 0x4000;
+    }
+
+    if (pc < 0x8000) {
+        return 0x8000;
+    }
+
+    if (BETWEEN(pc, 0xC000, 0xDFFF)) {
+        return 0xE000;
+    }
+
+    if (BETWEEN(pc, 0xFF80, 0xFFFE)) {
+        return 0xFFFF;
+    }
+
+    return 0;
+}
+
+static jit_block *block_slot(u16 pc) {
+    if (pc < 0x4000) {
+        return &ctx.rom0[pc];
+    }
+
+    if (pc < 0x8000) {
+        if (!ctx.romx[ctx.rom_bank]) {
+            ctx.romx[ctx.rom_bank] = calloc(0x4000, sizeof(jit_block));
+        }
+
+        return &ctx.romx[ctx.rom_bank][pc - 0x4000];
+    }
+
+    return &ctx.ram[pc - 0xC000];
+}
+
+// Drop every translated block and start over with an empty buffer
+void jit_flush() {
+    ctx.emit = ctx.code;
+
+    memset(ctx.rom0, 0, sizeof(ctx.rom0));
+    memset(ctx.ram, 0, sizeof(ctx.ram));
+    memset(jit_ram_code, 0, sizeof(jit_ram_code));
+    ctx.ram_block_count = 0;
+
+    for (int i = 0; i < 0x200; i++) {
+        if (ctx.romx[i]) {
+            memset(ctx.romx[i], 0, 0x4000 * sizeof(jit_block));
+        }
+    }
+
+    ctx.stats.flushes++;
+}
+
+static jit_block jit_compile(u16 pc, u32 end) {
+    if (ctx.emit + JIT_BLOCK_MAX_BYTES > ctx.code + JIT_CODE_SIZE ||
+        ctx.ram_block_count == JIT_MAX_RAM_BLOCKS) {
+        jit_flush();
+    }
+
+    u8 *start = ctx.emit;
+    u32 addr = pc;
+    u32 count = 0;
+    bool native = false;
+
+    emit_prologue();
+
+    while (count < JIT_MAX_BLOCK_INSTS) {
+        // Leave code under an execute watchpoint to the interpreter
+        if (watch_pages[(addr >> 8) & 0xFF] & WATCH_EXEC) {
+            break;
+        }
+
+        u8 op = bus_peek(addr);
+        instruction *inst = instruction_by_opcode(op);
+
+        if (addr + inst_length(inst->mode) > end) {
+            break;
+        }
+
+        count++;
+        native = emit_native(inst, addr, count);
+
+        if (!native) {
+            emit_processor(op, inst, addr, count);
+        }
+
+        addr += inst_length(inst->mode);
+
+        if (ends_block(inst->type)) {
+            break;
+        }
+    }
+
+    if (!count) {
+        ctx.emit = start;
+        return NULL;
+    }
+
+    emit_exit(count, native ? (int)addr : -1);
+
+    // Count the blocks covering each RAM byte, a write to any of them
+    // drops those blocks
+    if (pc >= 0xC000) {
+        ctx.ram_blocks[ctx.ram_block_count++] = (jit_ram_block){pc, addr};
+
+        for (u32 a = pc; a < addr; a++) {
+            if (jit_ram_code[a - 0xC000] != 0xFF) {
+                jit_ram_code[a - 0xC000]++;
+            }
+        }
+    }
+
+    ctx.stats.blocks_compiled++;
+    return (jit_block)start;
+}
+
+void jit_init() {
+    for (int i = 0; i < 0x100; i++) {
+        // LAHF: SF ZF - AF - PF - CF
+        ctx.flag_lut[i] = (BIT(i, 6) << 7) | (BIT(i, 4) << 5) | (BIT(i, 0) << 4);
+    }
+
+    if (!ctx.code) {
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (code == MAP_FAILED) {
+            fprintf(stderr, "JIT: failed to map code buffer, using the interpreter\n");
+            return;
+        }
+
+        ctx.code = code;
+    }
+
+    jit_flush();
+    ctx.stats.flushes = 0;
+}
+
+u32 jit_run(cpu_context *cpu) {
+    u16 pc = cpu->regs.pc;
+    u32 end = region_end(pc);
+
+    if (!ctx.code || !end) {
+        return 0;
+    }
+
+    // The CPU sees the DMA's bytes on the bus it holds, not the code
+    // there, so those are left to the interpreter and never translated.
+    // Every region lies on one of the DMA's buses, its first page will do.
+    if (dma_transferring() && (bus_holder(pc) & BUS_HOLD_DMA)) {
+        return 0;
+    }
+
+    jit_block block = *block_slot(pc);
+
+    if (!block) {
+        block = jit_compile(pc, end);
+
+        if (!block) {
+            return 0;
+        }
+
+        // Looked up again, compiling may have flushed the tables
+        *block_slot(pc) = block;
+    }
+
+    ctx.dirty = false;
+    cpu_flags_sync(cpu);
+
+    u32 n = block(cpu);
+
+    ctx.stats.blocks_run++;
+    ctx.stats.insts_run += n;
+    return n;
+}
+
+void jit_invalidate_ram(u16 address) {
+    for (u32 i = 0; i < ctx.ram_block_count;) {
+        jit_ram_block *b = &ctx.ram_blocks[i];
+
+        if (address < b->start || address >= b->end) {
+            i++;
+            continue;
+        }
+
+        ctx.ram[b->start - 0xC000] = NULL;
+
+        // A saturated count stays set, at worst costing a spurious call
+        for (u32 a = b->start; a < b->end; a++) {
+            if (jit_ram_code[a - 0xC000] != 0xFF) {
+                jit_ram_code[a - 0xC000]--;
+            }
+        }
+
+        *b = ctx.ram_blocks[--ctx.ram_block_count];
+    }
+
+    ctx.dirty = true;
+    ctx.stats.ram_invalidations++;
+}
+
+void jit_map_rom_bank(u16 bank) {
+    ctx.rom_bank = bank & 0x1FF;
+    ctx.dirty = true;
+}
+
+// Only MBC1 carts of 1 MB and up switch 0000-3FFF, rare enough that the
+// bank 0 blocks are simply dropped instead of kept per bank
+void jit_map_rom_bank0(u16 bank) {
+    if (bank == ctx.rom0_bank) {
+        return;
+    }
+
+    ctx.rom0_bank = bank;
+    memset(ctx.rom0, 0, sizeof(ctx.rom0));
+    ctx.dirty = true;
+}
+
+jit_stats *jit_get_stats() {
+    return &ctx.stats;
+}
+
+#else
+
+// Built without the recompiler, or on a host it doesn't target
+
+static jit_stats stats;
+
+void jit_init() {}
+
+u32 jit_run(cpu_context *cpu) {
+    return 0;
+}
+
+void jit_invalidate_ram(u16 address) {}
+
+void jit_map_rom_bank(u16 bank) {}
+
+void jit_map_rom_bank0(u16 bank) {}
+
+void jit_flush() {}
+
+jit_stats *jit_get_stats() {
+    return &stats;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <lcd.h>
 #include <ppu.h>
 #include <dma.h>
+#include <emu.h>
 
 static lcd_context ctx;
 
@@ -32,13 +33,31 @@ lcd_context *lcd_get_context() {
     return &ctx;
 }
 
+// LCD registers in FF40-FF4B, the I/O table has already applied the
+// read-only bits of STAT and LY
+// Reference: https://gbdev.io/pandocs/Hardware_Reg_List.html
+static u8 *lcd_register(u16 address) {
+    switch (address) {
+        case 0xFF40: return &ctx.lcdc;
+        case 0xFF41: return &ctx.lcds;
+        case 0xFF42: return &ctx.scroll_y;
+        case 0xFF43: return &ctx.scroll_x;
+        case 0xFF44: return &ctx.ly;
+        case 0xFF45: return &ctx.ly_compare;
+        case 0xFF46: return &ctx.dma;
+        case 0xFF47: return &ctx.bg_palette;
+        case 0xFF48: return &ctx.obj_palette[0];
+        case 0xFF49: return &ctx.obj_palette[1];
+        case 0xFF4A: return &ctx.win_y;
+        default:     return &ctx.win_x;
+    }
+}
+
 u8 lcd_read(u16 address) {
-    u8 offset = (address - 0xFF40);
-    // Cast context into a byte array
-    u8 *p = (u8 *)&ctx;
+    // STAT's mode bits are only current once the PPU has caught up
+    ppu_sync(emu_get_context()->ticks);
 
-    // Return byte array at offset
-    return p[offset];
+    return *lcd_register(address);
 }
 
 void update_palette(u8 palette_data, u8 pal) {
@@ -63,25 +82,45 @@ void update_palette(u8 palette_data, u8 pal) {
 }
 
 void lcd_write(u16 address, u8 value) {
-    u8 offset = (address - 0xFF40);
-    // Cast context into a byte array
-    u8 *p = (u8 *)&ctx;
-    // Write value to byte array at offset
-    p[offset] = value;
-
-    // Deal with DMA case
-    if (offset == 6) {
-        //0xFF46 = DMA
-        dma_start(value);
+    // Draw everything before the write with the old value, mid-scanline
+    // changes to scroll, palettes or LCDC only affect the pixels after it
+    ppu_sync(emu_get_context()->ticks);
+
+    // STAT, LYC and DMA aside, these are all read while drawing
+    if (address != 0xFF41 && address != 0xFF45 && address != 0xFF46) {
+        ppu_xfer_write();
     }
 
-    // Deal with palette cases
-    if (address == 0xFF47) {
-        update_palette(value, 0);
-    } else if (address == 0xFF48) {
-        update_palette(value & 0b11111100, 1);
-    } else if (address == 0xFF49) {
-        update_palette(value & 0b11111100, 2);
+    switch (address) {
+        // Only the interrupt sources are written, the mode and LYC flag
+        // belong to the PPU. They decide when it next has work to do.
+        case 0xFF41:
+            ctx.lcds = (ctx.lcds & 0b111) | value;
+            ppu_reschedule();
+            return;
+
+        // Deal with DMA case
+        case 0xFF46:
+            ctx.dma = value;
+            dma_start(value);
+            return;
+
+        // Deal with palette cases
+        case 0xFF47:
+            ctx.bg_palette = value;
+            update_palette(value, 0);
+            return;
+
+        case 0xFF48:
+            ctx.obj_palette[0] = value;
+            update_palette(value & 0b11111100, 1);
+            return;
+
+        case 0xFF49:
+            ctx.obj_palette[1] = value;
+            update_palette(value & 0b11111100, 2);
+            return;
     }
-}
 
+    *lcd_register(address) = value;
+}
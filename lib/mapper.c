@@ -0,0 +1,281 @@
+#include <mapper.h>
+#include <emu.h>
+#include <string.h>
+
+// Bank n of the ROM, numbers past the end wrap around like the unused
+// upper bank lines on real carts
+static u8 *rom_bank(cart_context *cart, u32 bank) {
+    return cart->rom_data + (bank % cart->rom_banks) * 0x4000;
+}
+
+// 8 KB RAM bank n, NULL if the cart has no RAM
+static u8 *ram_bank(cart_context *cart, u32 bank) {
+    if (!cart->ram_data) {
+        return NULL;
+    }
+
+    return cart->ram_data + (bank % (cart->ram_size / 0x2000)) * 0x2000;
+}
+
+// Any value with 0xA in the lower 4 bits enables RAM
+static bool ram_enable_value(u8 value) {
+    return (value & 0xF) == 0xA;
+}
+
+// ROM only, optionally with up to 8 KB of RAM
+// Reference: https://gbdev.io/pandocs/nombc.html
+
+static void rom_only_write(cart_context *cart, u16 address, u8 value) {}
+
+static void rom_only_map(cart_context *cart) {
+    cart->rom_bank_0 = rom_bank(cart, 0);
+    cart->rom_bank_x = rom_bank(cart, 1);
+    cart->ram_bank = ram_bank(cart, 0);
+}
+
+// MBC1
+// Reference: https://gbdev.io/pandocs/MBC1.html
+
+static void mbc1_write(cart_context *cart, u16 address, u8 value) {
+    switch (address & 0x6000) {
+        // 0000-1FFF RAM enable
+        case 0x0000:
+            cart->ram_enabled = ram_enable_value(value);
+            break;
+
+        // 2000-3FFF ROM bank number, 0 behaves as 1
+        case 0x2000:
+            value &= 0b11111;
+            cart->rom_bank_value = value ? value : 1;
+            break;
+
+        // 4000-5FFF RAM bank number or upper bits of the ROM bank number
+        case 0x4000:
+            cart->ram_bank_value = value & 0b11;
+            break;
+
+        // 6000-7FFF banking mode select
+        case 0x6000:
+            cart->banking_mode = value & 1;
+            break;
+    }
+}
+
+static void mbc1_map(cart_context *cart) {
+    u32 upper = cart->ram_bank_value << 5;
+
+    // Mode 1 also applies the upper bits to 0000-3FFF and selects the RAM bank
+    cart->rom_bank_0 = rom_bank(cart, cart->banking_mode ? upper : 0);
+    cart->rom_bank_x = rom_bank(cart, upper | cart->rom_bank_value);
+    cart->ram_bank = cart->ram_enabled ?
+        ram_bank(cart, cart->banking_mode ? cart->ram_bank_value : 0) : NULL;
+}
+
+// MBC2, 512 x 4 bit RAM built into the controller
+// Reference: https://gbdev.io/pandocs/MBC2.html
+
+static void mbc2_write(cart_context *cart, u16 address, u8 value) {
+    if (address >= 0x4000) {
+        return;
+    }
+
+    // Bit 8 of the address selects between RAM enable and ROM bank
+    if (address & 0x100) {
+        value &= 0xF;
+        cart->rom_bank_value = value ? value : 1;
+    } else {
+        cart->ram_enabled = ram_enable_value(value);
+    }
+}
+
+static void mbc2_map(cart_context *cart) {
+    cart->rom_bank_0 = rom_bank(cart, 0);
+    cart->rom_bank_x = rom_bank(cart, cart->rom_bank_value);
+    cart->ram_bank = NULL;
+}
+
+// Only the lower 9 bits are decoded, so the RAM repeats through A000-BFFF
+static u8 mbc2_ram_read(cart_context *cart, u16 address) {
+    if (!cart->ram_enabled) {
+        return 0xFF;
+    }
+
+    return 0xF0 | cart->ram_data[address & 0x1FF];
+}
+
+static void mbc2_ram_write(cart_context *cart, u16 address, u8 value) {
+    if (cart->ram_enabled) {
+        cart->ram_data[address & 0x1FF] = value & 0xF;
+        dirty_mark(&cart->ram_dirty, address & 0x1FF);
+    }
+}
+
+// MBC3, with the optional real time clock
+// Reference: https://gbdev.io/pandocs/MBC3.html
+
+#define RTC_TICKS_PER_SECOND 4194304
+
+#define RTC_DH_CARRY (1 << 7)
+#define RTC_DH_HALT (1 << 6)
+
+// Bring the clock up to the current tick, it keeps counting while the
+// registers aren't looked at
+static void rtc_advance(cart_rtc *rtc) {
+    u64 now = emu_get_context()->ticks;
+
+    if (rtc->regs[4] & RTC_DH_HALT) {
+        rtc->tick = now;
+        return;
+    }
+
+    u64 seconds = (now - rtc->tick) / RTC_TICKS_PER_SECOND;
+
+    if (!seconds) {
+        return;
+    }
+
+    rtc->tick += seconds * RTC_TICKS_PER_SECOND;
+
+    u64 carry = rtc->regs[0] + seconds;
+    rtc->regs[0] = carry % 60;
+    carry = rtc->regs[1] + carry / 60;
+    rtc->regs[1] = carry % 60;
+    carry = rtc->regs[2] + carry / 60;
+    rtc->regs[2] = carry % 24;
+
+    u64 days = (rtc->regs[3] | ((rtc->regs[4] & 1) << 8)) + carry / 24;
+
+    if (days > 0x1FF) {
+        rtc->regs[4] |= RTC_DH_CARRY;
+    }
+
+    rtc->regs[3] = days & 0xFF;
+    rtc->regs[4] = (rtc->regs[4] & ~1) | ((days >> 8) & 1);
+}
+
+static bool mbc3_rtc_selected(cart_context *cart) {
+    return BETWEEN(cart->ram_bank_value, 0x08, 0x0C);
+}
+
+static void mbc3_write(cart_context *cart, u16 address, u8 value) {
+    switch (address & 0x6000) {
+        // 0000-1FFF RAM and timer enable
+        case 0x0000:
+            cart->ram_enabled = ram_enable_value(value);
+            break;
+
+        // 2000-3FFF ROM bank number, 0 behaves as 1
+        case 0x2000:
+            value &= 0x7F;
+            cart->rom_bank_value = value ? value : 1;
+            break;
+
+        // 4000-5FFF RAM bank number 00-03 or RTC register 08-0C
+        case 0x4000:
+            cart->ram_bank_value = value;
+            break;
+
+        // 6000-7FFF writing 0 then 1 latches the clock
+        case 0x6000:
+            if (cart->rtc.latch == 0 && value == 1) {
+                rtc_advance(&cart->rtc);
+                memcpy(cart->rtc.latched, cart->rtc.regs, sizeof(cart->rtc.regs));
+            }
+
+            cart->rtc.latch = value;
+            break;
+    }
+}
+
+static void mbc3_map(cart_context *cart) {
+    cart->rom_bank_0 = rom_bank(cart, 0);
+    cart->rom_bank_x = rom_bank(cart, cart->rom_bank_value);
+    cart->ram_bank = cart->ram_enabled && cart->ram_bank_value < 4 ?
+        ram_bank(cart, cart->ram_bank_value) : NULL;
+}
+
+static u8 mbc3_ram_read(cart_context *cart, u16 address) {
+    if (!cart->ram_enabled || !mbc3_rtc_selected(cart)) {
+        return 0xFF;
+    }
+
+    return cart->rtc.latched[cart->ram_bank_value - 0x08];
+}
+
+static void mbc3_ram_write(cart_context *cart, u16 address, u8 value) {
+    if (!cart->ram_enabled || !mbc3_rtc_selected(cart)) {
+        return;
+    }
+
+    rtc_advance(&cart->rtc);
+    cart->rtc.regs[cart->ram_bank_value - 0x08] = value;
+
+    // Writing the seconds restarts the current second
+    if (cart->ram_bank_value == 0x08) {
+        cart->rtc.tick = emu_get_context()->ticks;
+    }
+}
+
+// MBC5
+// Reference: https://gbdev.io/pandocs/MBC5.html
+
+static void mbc5_write(cart_context *cart, u16 address, u8 value) {
+    switch (address & 0x7000) {
+        // 0000-1FFF RAM enable
+        case 0x0000:
+        case 0x1000:
+            cart->ram_enabled = ram_enable_value(value);
+            break;
+
+        // 2000-2FFF lower 8 bits of the ROM bank number, bank 0 is allowed
+        case 0x2000:
+            cart->rom_bank_value = (cart->rom_bank_value & 0x100) | value;
+            break;
+
+        // 3000-3FFF bit 8 of the ROM bank number
+        case 0x3000:
+            cart->rom_bank_value = (cart->rom_bank_value & 0xFF) | ((value & 1) << 8);
+            break;
+
+        // 4000-5FFF RAM bank number
+        case 0x4000:
+        case 0x5000:
+            cart->ram_bank_value = value & 0xF;
+            break;
+    }
+}
+
+static void mbc5_map(cart_context *cart) {
+    cart->rom_bank_0 = rom_bank(cart, 0);
+    cart->rom_bank_x = rom_bank(cart, cart->rom_bank_value);
+    cart->ram_bank = cart->ram_enabled ? ram_bank(cart, cart->ram_bank_value) : NULL;
+}
+
+static const cart_mapper mappers[] = {
+    { "ROM ONLY", rom_only_write, rom_only_map, NULL, NULL },
+    { "MBC1", mbc1_write, mbc1_map, NULL, NULL },
+    { "MBC2", mbc2_write, mbc2_map, mbc2_ram_read, mbc2_ram_write },
+    { "MBC3", mbc3_write, mbc3_map, mbc3_ram_read, mbc3_ram_write },
+    { "MBC5", mbc5_write, mbc5_map, NULL, NULL },
+};
+
+// Reference: https://gbdev.io/pandocs/The_Cartridge_Header.html#0147--cartridge-type
+const cart_mapper *mapper_for_type(u8 type) {
+    if (BETWEEN(type, 0x01, 0x03)) {
+        return &mappers[1];
+    }
+
+    if (BETWEEN(type, 0x05, 0x06)) {
+        return &mappers[2];
+    }
+
+    if (BETWEEN(type, 0x0F, 0x13)) {
+        return &mappers[3];
+    }
+
+    if (BETWEEN(type, 0x19, 0x1E)) {
+        return &mappers[4];
+    }
+
+    return &mappers[0];
+}
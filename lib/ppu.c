@@ -2,6 +2,10 @@
 #include <lcd.h>
 #include <string.h>
 #include <ppu_sm.h>
+#include <sched.h>
+#include <emu.h>
+#include <bus.h>
+#include <tile.h>
 
 void pipeline_fifo_reset();
 void pipeline_process();
@@ -12,6 +16,17 @@ ppu_context *ppu_get_context() {
     return &ctx;
 }
 
+// The first byte of a row holds the low bit of each pixel, the second the
+// high bit, leftmost pixel in bit 7
+// Reference: https://gbdev.io/pandocs/Tile_Data.html
+static void ppu_decode_row(u16 row) {
+    u8 low = ctx.vram[row * 2];
+    u8 high = ctx.vram[row * 2 + 1];
+
+    tile_decode_row(low, high, false, ctx.tiles.rows[row]);
+    tile_decode_row(low, high, true, ctx.tiles.flipped[row]);
+}
+
 void ppu_init() {
     ctx.current_frame = 0;
     ctx.line_ticks = 0;
@@ -23,19 +38,38 @@ void ppu_init() {
     ctx.pfc.pushed_x = 0;
     ctx.pfc.fetch_x = 0;
     ctx.pfc.pixel_fifo.size = 0;
-    ctx.pfc.pixel_fifo.head = ctx.pfc.pixel_fifo.tail = NULL;
+    ctx.pfc.pixel_fifo.head = 0;
     ctx.pfc.cur_fetch_state = FS_TILE;
 
-    ctx.line_sprites = 0;
+    ctx.line_sprite_count = 0;
+    ctx.sprite_lines_dirty = true;
     ctx.fetched_entry_count = 0;
     ctx.window_line = 0;
 
+    ctx.line_scanline = false;
+
     lcd_init();
     LCDS_MODE_SET(MODE_OAM);
 
     // Zero out memory
     memset(ctx.oam_ram, 0, sizeof(ctx.oam_ram));
     memset(ctx.video_buffer, 0, YRES * XRES * sizeof(u32));
+
+    tile_init();
+
+    for (int row = 0; row < TILE_COUNT * 8; row++) {
+        ppu_decode_row(row);
+    }
+
+    dirty_init(&ctx.vram_dirty, sizeof(ctx.vram), 4);
+    dirty_init(&ctx.oam_dirty, sizeof(ctx.oam_ram), 2);
+
+    ctx.synced_tick = emu_get_context()->ticks;
+    ppu_reschedule();
+
+    // The PPU never writes VRAM, so the CPU can read it directly. Writes
+    // go through ppu_vram_write after the PPU has caught up.
+    bus_map_read(0x8000, 0x2000, ctx.vram);
 }
 
 void ppu_tick() {
@@ -57,6 +91,125 @@ void ppu_tick() {
     }
 }
 
+void ppu_set_renderer(ppu_renderer renderer) {
+    ctx.renderer = renderer;
+}
+
+// Number of ticks that only advance line_ticks, without the PPU loading
+// sprites, changing mode or moving to the next line. Pixel transfer does
+// work every dot unless the scanline renderer draws the line at its end.
+static u32 ppu_quiet_ticks() {
+    u32 line_ticks = ctx.line_ticks;
+
+    switch(LCDS_MODE) {
+    case MODE_OAM:
+        // sprites load on tick 1, transfer starts on tick 80
+        return line_ticks && line_ticks < 79 ? 79 - line_ticks : 0;
+    case MODE_XFER:
+        return ctx.line_scanline && line_ticks < ctx.line_end - 1 ?
+            ctx.line_end - 1 - line_ticks : 0;
+    case MODE_HBLANK:
+    case MODE_VBLANK:
+        return line_ticks < TICKS_PER_LINE - 1 ? TICKS_PER_LINE - 1 - line_ticks : 0;
+    default:
+        return 0;
+    }
+}
+
+// Run every dot up to and including tick, the ones that only count are
+// added to line_ticks in one step
+static void ppu_run(u64 tick) {
+    while (ctx.synced_tick < tick) {
+        u64 left = tick - ctx.synced_tick;
+        u32 quiet = ppu_quiet_ticks();
+
+        if (quiet >= left) {
+            ctx.line_ticks += left;
+            ctx.synced_tick = tick;
+            return;
+        }
+
+        ctx.line_ticks += quiet;
+        ctx.synced_tick += quiet + 1;
+        ppu_tick();
+    }
+}
+
+// The CPU only sees the PPU through its registers, VRAM, OAM and
+// interrupts. Dots that can raise an interrupt have to run on time: the
+// line change, which moves LY and can raise the LYC, VBlank and STAT
+// interrupts, and the start of HBlank when its STAT interrupt is on.
+// Everything in between runs when the CPU next touches PPU state.
+static u64 ppu_next_event() {
+    u32 line_ticks = ctx.line_ticks;
+
+    if (LCDS_STAT_INT(SS_HBLANK) && (LCDS_MODE == MODE_OAM || LCDS_MODE == MODE_XFER)) {
+        return ctx.synced_tick + ppu_quiet_ticks() + 1;
+    }
+
+    // the line changes when line_ticks reaches 456, past that the line is
+    // still in pixel transfer and the PPU has to go dot by dot
+    if (line_ticks < TICKS_PER_LINE) {
+        return ctx.synced_tick + TICKS_PER_LINE - line_ticks;
+    }
+
+    return ctx.synced_tick + 1;
+}
+
+// Catch the PPU up to tick before its state is read or changed
+void ppu_sync(u64 tick) {
+    if (tick > ctx.synced_tick) {
+        ppu_run(tick);
+    }
+}
+
+// Register the next dot that has to run on time, also called by the LCD
+// after the CPU writes STAT or LY
+void ppu_reschedule() {
+    sched_schedule(EV_PPU, ppu_next_event());
+}
+
+// The mode changes on the dot line_ticks reaches 80, the end of pixel
+// transfer or the next line. Pixel transfer in the FIFO can end on any
+// dot, so there it's the next one.
+u64 ppu_stat_change() {
+    ppu_sync(emu_get_context()->ticks);
+
+    u32 line_ticks = ctx.line_ticks;
+    u32 change = 1;
+
+    switch(LCDS_MODE) {
+    case MODE_OAM:
+        change = line_ticks < 80 ? 80 - line_ticks : 1;
+        break;
+    case MODE_XFER:
+        change = ctx.line_scanline && line_ticks < ctx.line_end ?
+            ctx.line_end - line_ticks : 1;
+        break;
+    case MODE_HBLANK:
+    case MODE_VBLANK:
+        change = line_ticks < TICKS_PER_LINE ? TICKS_PER_LINE - line_ticks : 1;
+        break;
+    }
+
+    return ctx.synced_tick + change;
+}
+
+// Scheduled on the next dot that has to run on time. When that is the
+// start of HBlank, pixel transfer in the FIFO goes dot by dot, so as many
+// dots as possible run here: up to the CPU's tick or the next event of
+// another component.
+void ppu_event(u64 when) {
+    u64 until = emu_get_context()->ticks;
+
+    if (sched_next_tick <= until) {
+        until = sched_next_tick - 1;
+    }
+
+    ppu_run(until > when ? until : when);
+    ppu_reschedule();
+}
+
 void ppu_oam_write(u16 address, u8 value) {
     // when adressing buffer, use actual offset
     if (address >= 0xFE00) {
@@ -65,6 +218,14 @@ void ppu_oam_write(u16 address, u8 value) {
 
     u8 *p = (u8 *)ctx.oam_ram; // convert to byte array
     p[address] = value; // set value of byte array at that address
+    dirty_mark(&ctx.oam_dirty, address);
+    ctx.sprite_lines_dirty = true;
+}
+
+void ppu_oam_copy(const u8 *table) {
+    memcpy(ctx.oam_ram, table, sizeof(ctx.oam_ram));
+    dirty_mark_all(&ctx.oam_dirty);
+    ctx.sprite_lines_dirty = true;
 }
 
 u8 ppu_oam_read(u16 address) {
@@ -78,7 +239,14 @@ u8 ppu_oam_read(u16 address) {
 }
 
 void ppu_vram_write(u16 address, u8 value) {
+    ppu_xfer_write();
+
     ctx.vram[address - 0x8000] = value;
+    dirty_mark(&ctx.vram_dirty, address - 0x8000);
+
+    if (address < 0x9800) {
+        ppu_decode_row((address - 0x8000) / 2);
+    }
 }
 u8 ppu_vram_read(u16 address) {
     return ctx.vram[address - 0x8000];
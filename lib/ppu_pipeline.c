@@ -1,6 +1,6 @@
 #include <ppu.h>
 #include <lcd.h>
-#include <bus.h>
+#include <tile.h>
 
 // Check if window is visible
 bool window_visible() {
@@ -10,85 +10,119 @@ bool window_visible() {
 }
 
 // Push pixel value to the end of the pipeline
-// Classic linked-list implementation: https://www.geeksforgeeks.org/data-structures/linked-list/
 void pixel_fifo_push(u32 value) {
-    fifo_entry *next = malloc(sizeof(fifo_entry));
-    next->next = NULL;
-    next->value = value;
-
-    // Check if there are no entries in the pipeline
-    if (!ppu_get_context()->pfc.pixel_fifo.head) {
-        ppu_get_context()->pfc.pixel_fifo.head = ppu_get_context()->pfc.pixel_fifo.tail = next;
-    } else {
-        ppu_get_context()->pfc.pixel_fifo.tail->next = next;
-        ppu_get_context()->pfc.pixel_fifo.tail = next;
-    }
+    fifo *f = &ppu_get_context()->pfc.pixel_fifo;
 
-    ppu_get_context()->pfc.pixel_fifo.size++;
+    f->values[(f->head + f->size) % PIXEL_FIFO_SIZE] = value;
+    f->size++;
 }
 
 // Pop the first element out the pipeline
 u32 pixel_fifo_pop() {
+    fifo *f = &ppu_get_context()->pfc.pixel_fifo;
+
     // Check if pipeline is empty
-    if (ppu_get_context()->pfc.pixel_fifo.size <= 0) {
+    if (!f->size) {
         fprintf(stderr, "ERROR IN PIXEL FIFO\n");
         exit(-8);
     }
 
     // Remove first pixel from pipeline and update head
-    fifo_entry *popped = ppu_get_context()->pfc.pixel_fifo.head;
-    ppu_get_context()->pfc.pixel_fifo.head = popped->next;
-    ppu_get_context()->pfc.pixel_fifo.size--;
-
-    u32 val = popped->value;
-    free(popped);
+    u32 val = f->values[f->head];
+    f->head = (f->head + 1) % PIXEL_FIFO_SIZE;
+    f->size--;
 
     return val;
 }
 
-u32 fetch_sprite_pixels(int bit, u32 color, u8 bg_color) {
-    for (int i = 0; i < ppu_get_context()->fetched_entry_count; i++) {
-        int sp_x = (ppu_get_context()->fetched_entries[i].x - 8) + ((lcd_get_context()->scroll_x % 8));
+// Lay the fetched sprites over the 8 background colors pushed from fifo_x.
+// Each sprite row goes through its palette in one go, the indices only
+// decide which sprite, if any, shows at a pixel.
+static void fetch_sprite_pixels(int fifo_x, u32 *colors, const u8 *bg_pixels) {
+    ppu_context *ppu = ppu_get_context();
+    u32 sprite_colors[3][8];
 
-        if (sp_x + 8 < ppu_get_context()->pfc.fifo_x) {
-            // already past the pixel point
-            continue;
-        }
+    for (int i = 0; i < ppu->fetched_entry_count; i++) {
+        u32 *palette = ppu->fetched_entries[i].f_pn ?
+            lcd_get_context()->sp2_colors : lcd_get_context()->sp1_colors;
 
-        int offset = ppu_get_context()->pfc.fifo_x - sp_x; // where the pixel will go
+        tile_expand_row(ppu->pfc.entry_pixels[i], palette, sprite_colors[i]);
+    }
 
-        if (offset < 0 || offset > 7) {
-            // out of bounds
-            continue;
-        }
+    for (int x = 0; x < 8; x++) {
+        for (int i = 0; i < ppu->fetched_entry_count; i++) {
+            int sp_x = (ppu->fetched_entries[i].x - 8) + ((lcd_get_context()->scroll_x % 8));
+            int offset = fifo_x + x - sp_x; // where the pixel will go
 
-        bit = (7 - offset); // current bit we're working on, going in reverse order
+            if (offset < 0 || offset > 7) {
+                // out of bounds
+                continue;
+            }
 
-        if (ppu_get_context()->fetched_entries[i].f_x) { // flipped on the x-axis
-            bit = offset; // mirror
+            // the row is already mirrored for sprites flipped on the x-axis
+            if (!ppu->pfc.entry_pixels[i][offset]) {
+                // transparent
+                continue;
+            }
+
+            if (!ppu->fetched_entries[i].f_bgp || bg_pixels[x] == 0) {
+                colors[x] = sprite_colors[i][offset];
+                break;
+            }
         }
+    }
+}
 
-        u8 hi = !!(ppu_get_context()->pfc.fetch_entry_data[i * 2] & (1 << bit));
-        u8 lo = !!(ppu_get_context()->pfc.fetch_entry_data[(i * 2) + 1] & (1 << bit)) << 1;
+// Decoded pixels of a fetched tile row. The bytes were read on earlier
+// dots, so if VRAM has changed since they are decoded here instead.
+static u8 *pipeline_row(u16 row, u8 low, u8 high, bool flip, u8 *decoded) {
+    ppu_context *ppu = ppu_get_context();
 
-        bool bg_priority = ppu_get_context()->fetched_entries[i].f_bgp;
+    if (ppu->vram[row * 2] == low && ppu->vram[row * 2 + 1] == high) {
+        return flip ? ppu->tiles.flipped[row] : ppu->tiles.rows[row];
+    }
 
-        if (!(hi | lo)) {
-            // transparent 
-            continue;
-        }
+    tile_decode_row(low, high, flip, decoded);
 
-        if (!bg_priority || bg_color == 0) {
-            color = (ppu_get_context()->fetched_entries[i].f_pn) ?
-                lcd_get_context()->sp2_colors[hi|lo] : lcd_get_context()->sp1_colors[hi|lo];
+    return decoded;
+}
 
-            if (hi|lo) {
-                break;
-            }
+// Look up the rows of the background tile and the sprites about to be pushed
+static void pipeline_decode_tile() {
+    pixel_fifo_context *pfc = &ppu_get_context()->pfc;
+
+    pfc->bgw_pixels = pipeline_row(pfc->bgw_fetch_row, pfc->bgw_fetch_data[1],
+        pfc->bgw_fetch_data[2], false, pfc->decoded[0]);
+
+    for (int i = 0; i < ppu_get_context()->fetched_entry_count; i++) {
+        pfc->entry_pixels[i] = pipeline_row(pfc->fetch_entry_row[i],
+            pfc->fetch_entry_data[i * 2], pfc->fetch_entry_data[i * 2 + 1],
+            ppu_get_context()->fetched_entries[i].f_x, pfc->decoded[1 + i]);
+    }
+}
+
+// Colors of the 8 pixels of the fetched tile, the first one pushed at
+// fifo_x. The background row goes through its palette in one go, then the
+// sprites are laid over it.
+static void pipeline_tile_colors(u32 *colors) {
+    pixel_fifo_context *pfc = &ppu_get_context()->pfc;
+    u32 *palette = lcd_get_context()->bg_colors;
+    u32 blank[4];
+
+    if (!LCDC_BGW_ENABLE) {
+        // if background not enabled, grab the very first colour
+        for (int i = 0; i < 4; i++) {
+            blank[i] = palette[0];
         }
+
+        palette = blank;
     }
 
-    return color;
+    tile_expand_row(pfc->bgw_pixels, palette, colors);
+
+    if (LCDC_OBJ_ENABLE && ppu_get_context()->fetched_entry_count) {
+        fetch_sprite_pixels(pfc->fifo_x, colors, pfc->bgw_pixels);
+    }
 }
 
 // Keep trying to push pixels to pipeline until it succeeds
@@ -98,26 +132,17 @@ bool pipeline_fifo_add() {
         return false;
     }
 
-    int x = ppu_get_context()->pfc.fetch_x - (8 - (lcd_get_context()->scroll_x % 8));
-    for (int i = 0; i < 8; i++) {
-        int bit = 7 - i;
-        // Retrieve background pixel color using low and high tile data
-        u8 hi = !!(ppu_get_context()->pfc.bgw_fetch_data[1] & (1 << bit));
-        u8 lo = !!(ppu_get_context()->pfc.bgw_fetch_data[2] & (1 << bit)) << 1;
-        u32 color = lcd_get_context()->bg_colors[hi | lo];
-
-        if (!LCDC_BGW_ENABLE) {
-            // if background not enabled, grab the very first colour
-            color = lcd_get_context()->bg_colors[0];
-        }
+    u32 colors[8];
 
-        if (LCDC_OBJ_ENABLE) {
-            // look up colour
-            color = fetch_sprite_pixels(bit, color, hi | lo);
-        }
+    pipeline_decode_tile();
+    pipeline_tile_colors(colors);
 
+    // fetch_x is past the tile by now, so x never drops below 0 and every
+    // pixel is pushed at the fifo_x pipeline_tile_colors gave it
+    int x = ppu_get_context()->pfc.fetch_x - (8 - (lcd_get_context()->scroll_x % 8));
+    for (int i = 0; i < 8; i++) {
         if (x >= 0) {
-            pixel_fifo_push(color);
+            pixel_fifo_push(colors[i]);
             ppu_get_context()->pfc.fifo_x++;
         }
     }
@@ -127,22 +152,21 @@ bool pipeline_fifo_add() {
 
 // Load sprite tile from memory
 void pipeline_load_sprite_tile() {
-    oam_line_entry *le = ppu_get_context()->line_sprites;
+    ppu_context *ppu = ppu_get_context();
 
-    while (le) {
-        int sp_x = (le->entry.x - 8) + (lcd_get_context()->scroll_x % 8);
+    // max checking 3 sprites on pixels
+    for (int i = 0; i < ppu->line_sprite_count && ppu->fetched_entry_count < 3; i++) {
+        oam_entry *e = &ppu->line_sprites[i];
+        int sp_x = (e->x - 8) + (lcd_get_context()->scroll_x % 8);
 
-        if ((sp_x >= ppu_get_context()->pfc.fetch_x && sp_x < ppu_get_context()->pfc.fetch_x + 8) ||
-            ((sp_x + 8) >= ppu_get_context()->pfc.fetch_x && (sp_x + 8) < ppu_get_context()->pfc.fetch_x + 8)) {
-            // need to add entry
-            ppu_get_context()->fetched_entries[ppu_get_context()->fetched_entry_count++] = le->entry;
+        if (sp_x >= ppu->pfc.fetch_x + 8) {
+            // sorted by X, the rest are all further right
+            break;
         }
-        
-        le = le->next;
 
-        if (!le || ppu_get_context()->fetched_entry_count >= 3) {
-            // max checking 3 sprites on pixels
-            break;
+        if (sp_x + 8 >= ppu->pfc.fetch_x) {
+            // starts or ends within the tile, need to add entry
+            ppu->fetched_entries[ppu->fetched_entry_count++] = *e;
         }
     }
 }
@@ -165,7 +189,10 @@ void pipeline_load_sprite_data(u8 offset) {
             tile_index &= ~(1); // remove last bit
         }
 
-        ppu_get_context()->pfc.fetch_entry_data[(i * 2) + offset] = bus_read(0x8000 + (tile_index * 16) + ty + offset);
+        u16 row = tile_index * 8 + ty / 2;
+
+        ppu_get_context()->pfc.fetch_entry_row[i] = row;
+        ppu_get_context()->pfc.fetch_entry_data[(i * 2) + offset] = ppu_get_context()->vram[row * 2 + offset];
     }
 }
 
@@ -182,9 +209,9 @@ void pipeline_load_window_tile() {
                 if (lcd_get_context()->ly >= window_y && lcd_get_context()->ly < window_y + XRES) {
                     u8 w_tile_y = ppu_get_context()->window_line / 8;
 
-                    ppu_get_context()->pfc.bgw_fetch_data[0] = bus_read(LCDC_WIN_MAP_AREA +
+                    ppu_get_context()->pfc.bgw_fetch_data[0] = ppu_get_context()->vram[LCDC_WIN_MAP_AREA - 0x8000 +
                         ((ppu_get_context()->pfc.fetch_x + 7 - lcd_get_context()->win_x) / 8) +
-                        (w_tile_y * 32));
+                        (w_tile_y * 32)];
 
                     if (LCDC_BGW_DATA_AREA == 0x8800) {
                         ppu_get_context()->pfc.bgw_fetch_data[0] += 128;
@@ -193,55 +220,60 @@ void pipeline_load_window_tile() {
         }
 }
 
-// Fetch pixel depending on current state
-void pipeline_fetch() {
-    switch (ppu_get_context()->pfc.cur_fetch_state) {
-        // Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile
+// Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile
+static void pipeline_fetch_tile() {
+    ppu_get_context()->fetched_entry_count = 0;
 
-        case FS_TILE: {
-            ppu_get_context()->fetched_entry_count = 0;
-
-            // Check if background/window is enabled
-            if (LCDC_BGW_ENABLE) { 
-                ppu_get_context()->pfc.bgw_fetch_data[0] = bus_read(LCDC_BG_MAP_AREA + 
-                    (ppu_get_context()->pfc.map_x / 8) + 
-                    (((ppu_get_context()->pfc.map_y / 8)) * 32));
-                
-                if (LCDC_BGW_DATA_AREA == 0x8800) {
-                    ppu_get_context()->pfc.bgw_fetch_data[0] += 128;  // increment tile id
-                }
+    // Check if background/window is enabled
+    if (LCDC_BGW_ENABLE) { 
+        ppu_get_context()->pfc.bgw_fetch_data[0] = ppu_get_context()->vram[LCDC_BG_MAP_AREA - 0x8000 + 
+            (ppu_get_context()->pfc.map_x / 8) + 
+            (((ppu_get_context()->pfc.map_y / 8)) * 32)];
+        
+        if (LCDC_BGW_DATA_AREA == 0x8800) {
+            ppu_get_context()->pfc.bgw_fetch_data[0] += 128;  // increment tile id
+        }
 
-                pipeline_load_window_tile();
-            }
+        pipeline_load_window_tile();
+    }
 
-            // Check if sprites are enabled
-            if (LCDC_OBJ_ENABLE && ppu_get_context()->line_sprites) {
-                pipeline_load_sprite_tile();
-            }
+    // Check if sprites are enabled
+    if (LCDC_OBJ_ENABLE && ppu_get_context()->line_sprite_count) {
+        pipeline_load_sprite_tile();
+    }
+
+    ppu_get_context()->pfc.fetch_x += 8;
+}
+
+// Low (offset 0) or high (offset 1) byte of the tile data
+// Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile-data-low
+// Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile-data-high
+static void pipeline_fetch_data(u8 offset) {
+    u16 row = (LCDC_BGW_DATA_AREA - 0x8000 + 
+        (ppu_get_context()->pfc.bgw_fetch_data[0] * 16) + 
+        ppu_get_context()->pfc.tile_y) / 2;
+
+    ppu_get_context()->pfc.bgw_fetch_row = row;
+    ppu_get_context()->pfc.bgw_fetch_data[1 + offset] = ppu_get_context()->vram[row * 2 + offset];
 
+    pipeline_load_sprite_data(offset);
+}
+
+// Fetch pixel depending on current state
+void pipeline_fetch() {
+    switch (ppu_get_context()->pfc.cur_fetch_state) {
+        case FS_TILE: {
+            pipeline_fetch_tile();
             ppu_get_context()->pfc.cur_fetch_state = FS_DATA0;
-            ppu_get_context()->pfc.fetch_x += 8;
         } break;
 
-        // Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile-data-low
         case FS_DATA0: {
-            ppu_get_context()->pfc.bgw_fetch_data[1] = bus_read(LCDC_BGW_DATA_AREA + 
-                (ppu_get_context()->pfc.bgw_fetch_data[0] * 16) + 
-                ppu_get_context()->pfc.tile_y);
-            
-            pipeline_load_sprite_data(0);
-
+            pipeline_fetch_data(0);
             ppu_get_context()->pfc.cur_fetch_state = FS_DATA1;
         } break;
 
-        // Reference: https://gbdev.io/pandocs/pixel_fifo.html#get-tile-data-high
         case FS_DATA1: {
-            ppu_get_context()->pfc.bgw_fetch_data[2] = bus_read(LCDC_BGW_DATA_AREA + 
-                (ppu_get_context()->pfc.bgw_fetch_data[0] * 16) + 
-                ppu_get_context()->pfc.tile_y + 1);
-
-            pipeline_load_sprite_data(1);
-
+            pipeline_fetch_data(1);
             ppu_get_context()->pfc.cur_fetch_state = FS_IDLE;
         } break;
 
@@ -276,12 +308,16 @@ void pipeline_push_pixel() {
     }
 }
 
-// Process pixel FIFO pipeline
-void pipeline_process() {
-    // Calculate tilemap X and Y coordinate
+// Calculate tilemap X and Y coordinate
+static void pipeline_map_position() {
     ppu_get_context()->pfc.map_x = (ppu_get_context()->pfc.fetch_x + lcd_get_context()->scroll_x);
     ppu_get_context()->pfc.map_y = (lcd_get_context()->ly + lcd_get_context()->scroll_y);
     ppu_get_context()->pfc.tile_y = ((lcd_get_context()->ly + lcd_get_context()->scroll_y) % 8) * 2;
+}
+
+// Process pixel FIFO pipeline
+void pipeline_process() {
+    pipeline_map_position();
 
     // Check if line is even-indexed
     if (!(ppu_get_context()->line_ticks & 1)) {
@@ -293,10 +329,76 @@ void pipeline_process() {
 
 // Reset FIFO pipeline after done processing
 void pipeline_fifo_reset() {
-    // Pop out every pixel in pipeline
-    while (ppu_get_context()->pfc.pixel_fifo.size) {
-        pixel_fifo_pop();
+    // Drop every pixel in pipeline
+    ppu_get_context()->pfc.pixel_fifo.size = 0;
+    ppu_get_context()->pfc.pixel_fifo.head = 0;
+}
+
+/*
+    Scanline renderer
+
+    With nothing written mid-line the FIFO above always runs the same way.
+    Starting on dot 81 it fetches a tile every 10 dots, the first on dot 82,
+    and pushes it 8 dots later whenever it holds 8 pixels or less. From the
+    second push on dot 100, it pops a pixel on every dot in which it holds
+    more than 8, so pixel n leaves on dot 100 + 10 * (n / 8) + n % 8. The
+    first SCX % 8 pixels are dropped and the line ends with the pop of
+    pixel 159 + SCX % 8.
+*/
+
+// Dot pixel transfer ends on for the current SCX
+u32 pipeline_line_end() {
+    u32 last = XRES - 1 + (lcd_get_context()->scroll_x % 8);
+
+    return 100 + 10 * (last / 8) + last % 8;
+}
+
+// Draw the whole line at once at the end of pixel transfer. The registers
+// haven't changed since it started, so running the fetches the FIFO would
+// have run by now, in the same order, gives the same pixels and leaves the
+// fetcher as the FIFO would, down to the tile id the next line may reuse.
+void pipeline_render_line() {
+    pixel_fifo_context *pfc = &ppu_get_context()->pfc;
+    u32 *line = ppu_get_context()->video_buffer + lcd_get_context()->ly * XRES;
+    u8 scroll = lcd_get_context()->scroll_x % 8;
+    u32 last = XRES - 1 + scroll;
+
+    // Tiles holding the pixels shown
+    for (u32 tile = 0; tile <= last / 8; tile++) {
+        pipeline_map_position();
+        pipeline_fetch_tile();
+        pipeline_fetch_data(0);
+        pipeline_fetch_data(1);
+        pipeline_decode_tile();
+
+        // Tiles fully on screen go straight into the line
+        if (pfc->line_x >= scroll && pfc->pushed_x + 8 <= XRES) {
+            pipeline_tile_colors(line + pfc->pushed_x);
+            pfc->pushed_x += 8;
+        } else {
+            u32 colors[8];
+
+            pipeline_tile_colors(colors);
+
+            for (int i = 0; i < 8; i++) {
+                if (pfc->line_x + i >= scroll && pfc->pushed_x < XRES) {
+                    line[pfc->pushed_x++] = colors[i];
+                }
+            }
+        }
+
+        pfc->line_x += 8;
+        pfc->fifo_x += 8;
     }
 
-    ppu_get_context()->pfc.pixel_fifo.head = 0;
+    // The FIFO also fetched the tile after the last one shown, which it
+    // pushed on the dot its first pixel was popped, and started on the one
+    // after that if the line had two more dots
+    pipeline_map_position();
+    pipeline_fetch_tile();
+
+    if (last % 8 >= 2) {
+        pipeline_map_position();
+        pipeline_fetch_tile();
+    }
 }
@@ -31,60 +31,76 @@ void increment_ly() {
     }
 }
 
-// load all sprites on a given line
-void load_line_sprites() {
-    int cur_y = lcd_get_context()->ly;
-
-    u8 sprite_height = LCDC_OBJ_HEIGHT;
-    memset(ppu_get_context()->line_entry_array, 0, sizeof(ppu_get_context()->line_entry_array));
+// Sort every sprite into the lines it covers. Like the PPU's OAM scan,
+// the first 10 in OAM with a nonzero X take a line, sprites at X 0 don't
+// count towards the limit.
+// Reference: https://gbdev.io/pandocs/OAM.html#selection-priority
+static void build_sprite_lines() {
+    ppu_context *ppu = ppu_get_context();
+    int sprite_height = LCDC_OBJ_HEIGHT;
+
+    for (int y = 0; y < YRES; y++) {
+        ppu->sprite_lines[y].count = 0;
+    }
 
     for (int i = 0; i < 40; i++) { // each of 40 oam entries
-        oam_entry e = ppu_get_context()->oam_ram[i];
+        oam_entry *e = &ppu->oam_ram[i];
 
-        if (!e.x) {
+        if (!e->x) {
             // x = 0 means not visible
             continue;
         }
 
-        if (ppu_get_context()->line_sprite_count >= 10) {
-            // max 10 sprites per line
-            break;
-        }
+        int top = e->y - 16;
 
-        if (e.y <= cur_y + 16 && e.y + sprite_height > cur_y + 16) {
-            // this sprite is on the current line
-            oam_line_entry *entry = &ppu_get_context()->line_entry_array[ppu_get_context()->line_sprite_count++];
+        for (int y = top < 0 ? 0 : top; y < top + sprite_height && y < YRES; y++) {
+            sprite_bucket *b = &ppu->sprite_lines[y];
 
-            entry->entry = e;
-            entry->next = NULL;
-
-            if (!ppu_get_context()->line_sprites || ppu_get_context()->line_sprites->entry.x > e.x) {
-                entry->next = ppu_get_context()->line_sprites;
-                ppu_get_context()->line_sprites = entry;
+            if (b->count >= LINE_SPRITES) {
+                // max 10 sprites per line
                 continue;
             }
 
-            // sorting, otherwise some sprites will not render properly
-            oam_line_entry *le = ppu_get_context()->line_sprites;
-            oam_line_entry *prev = le;
-
-            while (le) {
-                if (le->entry.x > e.x) {
-                    prev->next = entry; // put at end of the linked list
-                    entry->next = le;
-                    break;
-                }
-
-                if (!le->next) {
-                    le->next = entry;
-                    break;
-                }
+            // sorting, otherwise some sprites will not render properly,
+            // after the ones at the same X which come first in OAM
+            int n = b->count++;
 
-                prev = le;
-                le = le->next;
+            while (n && ppu->oam_ram[b->sprites[n - 1]].x > e->x) {
+                b->sprites[n] = b->sprites[n - 1];
+                n--;
             }
+
+            b->sprites[n] = i;
         }
     }
+
+    ppu->sprite_lines_dirty = false;
+    ppu->sprite_lines_height = sprite_height;
+}
+
+// load all sprites on a given line
+void load_line_sprites() {
+    ppu_context *ppu = ppu_get_context();
+    int cur_y = lcd_get_context()->ly;
+
+    if (ppu->sprite_lines_dirty || ppu->sprite_lines_height != LCDC_OBJ_HEIGHT) {
+        build_sprite_lines();
+    }
+
+    ppu->line_sprite_count = 0;
+
+    if (cur_y >= YRES) {
+        return;
+    }
+
+    // Copied, the line keeps the sprites it started with
+    sprite_bucket *b = &ppu->sprite_lines[cur_y];
+
+    for (int i = 0; i < b->count; i++) {
+        ppu->line_sprites[i] = ppu->oam_ram[b->sprites[i]];
+    }
+
+    ppu->line_sprite_count = b->count;
 }
 
 void ppu_mode_oam() {
@@ -98,30 +114,61 @@ void ppu_mode_oam() {
         ppu_get_context()->pfc.fetch_x = 0;
         ppu_get_context()->pfc.pushed_x = 0;
         ppu_get_context()->pfc.fifo_x = 0;
+
+        ppu_get_context()->line_scanline = ppu_get_context()->renderer == RENDER_SCANLINE;
+        ppu_get_context()->line_end = pipeline_line_end();
     }
 
     if (ppu_get_context()->line_ticks == 1) {
         // read oam on the first tick only...
-        ppu_get_context()->line_sprites = 0;
-        ppu_get_context()->line_sprite_count = 0;
-
         load_line_sprites();
     }
 }
 
 void ppu_mode_xfer() {
-    pipeline_process();
+    if (ppu_get_context()->line_scanline) {
+        // The dots before the end only count
+        if (ppu_get_context()->line_ticks < ppu_get_context()->line_end) {
+            return;
+        }
 
-    // Change PPU mode if pushed pixels exceeds X resolution
-    if (ppu_get_context()->pfc.pushed_x >= XRES) {
-        pipeline_fifo_reset();
-        LCDS_MODE_SET(MODE_HBLANK);
+        pipeline_render_line();
+    } else {
+        pipeline_process();
 
-        // Check if STAT interrupt is set
-        if (LCDS_STAT_INT(SS_HBLANK)) {
-            cpu_request_interrupt(IT_LCD_STAT);
+        // Change PPU mode if pushed pixels exceeds X resolution
+        if (ppu_get_context()->pfc.pushed_x < XRES) {
+            return;
         }
     }
+
+    pipeline_fifo_reset();
+    LCDS_MODE_SET(MODE_HBLANK);
+
+    // Check if STAT interrupt is set
+    if (LCDS_STAT_INT(SS_HBLANK)) {
+        cpu_request_interrupt(IT_LCD_STAT);
+    }
+}
+
+// Everything the line has drawn so far saw the old value, so the FIFO runs
+// the dots of the line up to now and takes over the rest of it
+void ppu_xfer_write() {
+    if (LCDS_MODE != MODE_XFER || !ppu_get_context()->line_scanline) {
+        return;
+    }
+
+    u32 now = ppu_get_context()->line_ticks;
+
+    ppu_get_context()->line_scanline = false;
+
+    for (u32 dot = 81; dot <= now; dot++) {
+        ppu_get_context()->line_ticks = dot;
+        pipeline_process();
+    }
+
+    ppu_get_context()->line_ticks = now;
+    ppu_reschedule();
 }
 
 void ppu_mode_vblank() {
@@ -1,12 +1,32 @@
 #include <ram.h>
+#include <jit.h>
+#include <bus.h>
 
 typedef struct {
     u8 wram[0x2000];
-    u8 hram[0x80];
+    dirty_map wram_dirty;       // per 256 byte page
 } ram_context;
 
 static ram_context ctx;
 
+u8 hram[0x80];
+
+dirty_map *wram_get_dirty() {
+    return &ctx.wram_dirty;
+}
+
+// WRAM is plain memory, reads and writes go straight to it. With the
+// recompiler on, writes still go through wram_write to catch code changes.
+void ram_init() {
+    dirty_init(&ctx.wram_dirty, sizeof(ctx.wram), 8);
+
+    bus_map_read(0xC000, 0x2000, ctx.wram);
+
+#if !CPU_JIT
+    bus_map_write(0xC000, 0x2000, ctx.wram, ctx.wram_dirty.blocks);
+#endif
+}
+
 u8 wram_read(u16 address) {
     address -= 0xC000;
     return ctx.wram[address];
@@ -15,14 +35,27 @@ u8 wram_read(u16 address) {
 void wram_write(u16 address, u8 value) {
     address -= 0xC000;
     ctx.wram[address] = value;
+    dirty_mark(&ctx.wram_dirty, address);
+
+#if CPU_JIT
+    if (jit_ram_code[address]) {
+        jit_invalidate_ram(address + 0xC000);
+    }
+#endif
 }
 
 u8 hram_read(u16 address) {
     address -= 0xFF80;
-    return ctx.hram[address];
+    return hram[address];
 }
 
 void hram_write(u16 address, u8 value) {
     address -= 0xFF80;
-    ctx.hram[address] = value;
+    hram[address] = value;
+
+#if CPU_JIT
+    if (jit_ram_code[address + 0x3F80]) {
+        jit_invalidate_ram(address + 0xFF80);
+    }
+#endif
 }
@@ -0,0 +1,134 @@
+#include <sched.h>
+#include <timer.h>
+#include <ppu.h>
+#include <dma.h>
+#include <io.h>
+
+typedef void (*sched_handler)(u64 when);
+
+typedef struct {
+    u8 heap[EV_COUNT];       // binary min-heap of pending events
+    u8 size;
+    int pos[EV_COUNT];       // index of each event in the heap, -1 if not pending
+    u64 when[EV_COUNT];      // tick each pending event is due
+} sched_context;
+
+static sched_context ctx;
+
+u64 sched_next_tick = UINT64_MAX;
+
+static const sched_handler handlers[EV_COUNT] = {
+    [EV_TIMER] = timer_event,
+    [EV_PPU] = ppu_event,
+    [EV_DMA] = dma_event,
+    [EV_SERIAL] = serial_event,
+};
+
+void sched_init() {
+    ctx.size = 0;
+
+    for (int i = 0; i < EV_COUNT; i++) {
+        ctx.pos[i] = -1;
+    }
+
+    sched_next_tick = UINT64_MAX;
+}
+
+// Ordered by tick, events due on the same tick by their enum value
+static bool sched_before(u8 a, u8 b) {
+    return ctx.when[a] < ctx.when[b] || (ctx.when[a] == ctx.when[b] && a < b);
+}
+
+static void sched_place(u8 i, u8 ev) {
+    ctx.heap[i] = ev;
+    ctx.pos[ev] = i;
+}
+
+static void sched_sift_up(u8 i) {
+    u8 ev = ctx.heap[i];
+
+    while (i) {
+        u8 parent = (i - 1) / 2;
+
+        if (!sched_before(ev, ctx.heap[parent])) {
+            break;
+        }
+
+        sched_place(i, ctx.heap[parent]);
+        i = parent;
+    }
+
+    sched_place(i, ev);
+}
+
+static void sched_sift_down(u8 i) {
+    u8 ev = ctx.heap[i];
+
+    while (true) {
+        u8 child = i * 2 + 1;
+
+        if (child >= ctx.size) {
+            break;
+        }
+
+        if (child + 1 < ctx.size && sched_before(ctx.heap[child + 1], ctx.heap[child])) {
+            child++;
+        }
+
+        if (!sched_before(ctx.heap[child], ev)) {
+            break;
+        }
+
+        sched_place(i, ctx.heap[child]);
+        i = child;
+    }
+
+    sched_place(i, ev);
+}
+
+static void sched_update_next() {
+    sched_next_tick = ctx.size ? ctx.when[ctx.heap[0]] : UINT64_MAX;
+}
+
+void sched_cancel(sched_event ev) {
+    int i = ctx.pos[ev];
+
+    if (i < 0) {
+        return;
+    }
+
+    ctx.pos[ev] = -1;
+    ctx.size--;
+
+    // move the last event into the hole and restore the heap order
+    if (i < ctx.size) {
+        u8 last = ctx.heap[ctx.size];
+
+        sched_place(i, last);
+        sched_sift_down(i);
+        sched_sift_up(ctx.pos[last]);
+    }
+
+    sched_update_next();
+}
+
+void sched_schedule(sched_event ev, u64 when) {
+    if (ctx.pos[ev] >= 0) {
+        sched_cancel(ev);
+    }
+
+    ctx.when[ev] = when;
+    sched_place(ctx.size++, ev);
+    sched_sift_up(ctx.pos[ev]);
+
+    sched_update_next();
+}
+
+void sched_run(u64 now) {
+    while (sched_next_tick <= now) {
+        u8 ev = ctx.heap[0];
+
+        sched_cancel(ev);
+        handlers[ev](ctx.when[ev]);
+    }
+}
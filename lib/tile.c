@@ -0,0 +1,115 @@
+#include <tile.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TILE_SIMD 1
+#include <immintrin.h>
+#else
+#define TILE_SIMD 0
+#endif
+
+static void decode_row_scalar(u8 low, u8 high, bool flip, u8 *indices) {
+    for (int x = 0; x < 8; x++) {
+        u8 bit = flip ? x : 7 - x;
+        indices[x] = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+    }
+}
+
+static void expand_row_scalar(const u8 *indices, const u32 *palette, u32 *pixels) {
+    for (int x = 0; x < 8; x++) {
+        pixels[x] = palette[indices[x] & 3];
+    }
+}
+
+#if TILE_SIMD
+
+// Each byte lane tests the bit of its pixel, both bitplanes at once
+__attribute__((target("sse2")))
+static void decode_row_sse2(u8 low, u8 high, bool flip, u8 *indices) {
+    __m128i mask = flip ?
+        _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0) :
+        _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    __m128i lo = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(low), mask), mask);
+    __m128i hi = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(high), mask), mask);
+
+    __m128i index = _mm_or_si128(_mm_and_si128(lo, _mm_set1_epi8(1)),
+        _mm_and_si128(hi, _mm_set1_epi8(2)));
+
+    _mm_storel_epi64((__m128i *)indices, index);
+}
+
+// No byte shuffle before SSSE3, so every pixel selects its color from
+// the four by comparing its index against each of them
+__attribute__((target("sse2")))
+static void expand_row_sse2(const u8 *indices, const u32 *palette, u32 *pixels) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i index16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)indices), zero);
+
+    for (int half = 0; half < 2; half++) {
+        __m128i index = half ? _mm_unpackhi_epi16(index16, zero) : _mm_unpacklo_epi16(index16, zero);
+        __m128i color = zero;
+
+        for (int i = 0; i < 4; i++) {
+            __m128i match = _mm_cmpeq_epi32(index, _mm_set1_epi32(i));
+            color = _mm_or_si128(color, _mm_and_si128(match, _mm_set1_epi32(palette[i])));
+        }
+
+        _mm_storeu_si128((__m128i *)(pixels + half * 4), color);
+    }
+}
+
+// One permute maps all 8 indices through the palette held in the low half
+__attribute__((target("avx2")))
+static void expand_row_avx2(const u8 *indices, const u32 *palette, u32 *pixels) {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)indices));
+    __m256i colors = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+
+    _mm256_storeu_si256((__m256i *)pixels, _mm256_permutevar8x32_epi32(colors, index));
+}
+
+#endif
+
+static const tile_kernels kernels[] = {
+    { "scalar", decode_row_scalar, expand_row_scalar },
+#if TILE_SIMD
+    { "sse2", decode_row_sse2, expand_row_sse2 },
+    { "avx2", decode_row_sse2, expand_row_avx2 },
+#endif
+};
+
+#define KERNEL_COUNT (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+const tile_kernels *tile_active = &kernels[0];
+
+static bool tile_supported(int n) {
+#if TILE_SIMD
+    __builtin_cpu_init();
+
+    switch (n) {
+        case 1: return __builtin_cpu_supports("sse2");
+        case 2: return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    return n == 0;
+}
+
+void tile_init() {
+    for (int n = 0; n < KERNEL_COUNT; n++) {
+        if (tile_supported(n)) {
+            tile_active = &kernels[n];
+        }
+    }
+}
+
+int tile_kernel_count() {
+    return KERNEL_COUNT;
+}
+
+const tile_kernels *tile_kernel(int n) {
+    if (n < 0 || n >= KERNEL_COUNT || !tile_supported(n)) {
+        return NULL;
+    }
+
+    return &kernels[n];
+}
@@ -1,55 +1,109 @@
 #include <timer.h>
 #include <interrupts.h>
+#include <sched.h>
+#include <emu.h>
 
 static timer_context ctx = {0};
 
+static void timer_schedule();
+
 timer_context *timer_get_context() {
     return &ctx;
 }
 
 void timer_init() {
-    ctx.div = 0xAC00;   // default divider value
+    u64 now = emu_get_context()->ticks;
+
+    ctx.div_offset = 0xABCC - now;   // divider value after the boot ROM
+    ctx.tima_tick = now;
+    timer_schedule();
 }
 
-void timer_tick() {
-    u16 prev_div = ctx.div;
-    ctx.div++;
+// Bit of div whose falling edge clocks TIMA for each TAC input clock
+// Reference: https://gbdev.io/pandocs/Timer_and_Divider_Registers.html#ff07--tac-timer-control
+static const u8 tac_div_bit[4] = {9, 3, 5, 7};
 
-    bool timer_update = false;
+// Value of the internal divider on a tick. It only goes forward from the
+// last DIV reset, so it never wraps between two ticks the timer compares.
+static u64 timer_counter(u64 tick) {
+    return tick + ctx.div_offset;
+}
 
-    // Updating timer control
-    // Reference: https://gbdev.io/pandocs/Timer_and_Divider_Registers.html#ff07--tac-timer-control
-    switch (ctx.tac & (0b11)) {
-        case 0b00:
-            timer_update = (prev_div & (1 << 9)) && (!(ctx.div & (1 << 9)));
-            break;
-        case 0b01:
-            timer_update = (prev_div & (1 << 3)) && (!(ctx.div & (1 << 3)));
-            break;
-        case 0b10:
-            timer_update = (prev_div & (1 << 5)) && (!(ctx.div & (1 << 5)));
-            break;
-        case 0b11:
-            timer_update = (prev_div & (1 << 7)) && (!(ctx.div & (1 << 7)));
-            break;
+// TIMA is clocked by the selected divider bit ANDed with the enable bit
+static bool timer_signal(u8 tac, u64 counter) {
+    return (tac & (1 << 2)) && (counter & (1 << tac_div_bit[tac & 0b11]));
+}
+
+// Number of TIMA increments between two ticks, one per falling edge of
+// the selected divider bit
+static u64 timer_edges(u64 from, u64 to) {
+    if (!(ctx.tac & (1 << 2))) {
+        return 0;
+    }
+
+    u8 shift = tac_div_bit[ctx.tac & 0b11] + 1;
+
+    return (timer_counter(to) >> shift) - (timer_counter(from) >> shift);
+}
+
+static void timer_increment() {
+    ctx.tima++;
+
+    if (ctx.tima == 0xFF) {
+        ctx.tima = ctx.tma;
+        cpu_request_interrupt(IT_TIMER);
+    }
+}
+
+// Bring TIMA up to date, no overflow can happen in between since it is
+// scheduled as an event
+static void timer_sync(u64 now) {
+    ctx.tima += timer_edges(ctx.tima_tick, now);
+    ctx.tima_tick = now;
+}
+
+// Register the tick TIMA next reaches 0xFF and reloads on
+static void timer_schedule() {
+    if (!(ctx.tac & (1 << 2))) {
+        sched_cancel(EV_TIMER);
+        return;
     }
 
-    // If timer needs updating and TAC is enabled, increment TIMA
-    if (timer_update && ctx.tac & (1 << 2)) {
-        ctx.tima++;
+    u8 shift = tac_div_bit[ctx.tac & 0b11] + 1;
+    u32 increments = (u8)(0xFF - ctx.tima);
 
-        if (ctx.tima == 0xFF) {
-            ctx.tima = ctx.tma;
-            cpu_request_interrupt(IT_TIMER);
-        }
+    if (!increments) {
+        increments = 0x100;
     }
+
+    // the nth falling edge is at the nth multiple of the period after now
+    u64 counter = ((timer_counter(ctx.tima_tick) >> shift) + increments) << shift;
+
+    sched_schedule(EV_TIMER, counter - ctx.div_offset);
+}
+
+// Scheduled on the tick TIMA reaches 0xFF
+void timer_event(u64 when) {
+    ctx.tima += timer_edges(ctx.tima_tick, when) - 1;
+    ctx.tima_tick = when;
+    timer_increment();
+
+    timer_schedule();
 }
 
 // Write to timer context based on address
 void timer_write(u16 address, u8 value) {
+    u64 now = emu_get_context()->ticks;
+
+    timer_sync(now);
+
+    // Resetting the divider or changing TAC can drop the TIMA clock signal
+    // from high to low, which counts as a falling edge
+    bool signal = timer_signal(ctx.tac, timer_counter(now));
+
     switch (address) {
         case 0xFF04:
-            ctx.div = 0;
+            ctx.div_offset = -now;
             break;
         case 0xFF05:
             ctx.tima = value;
@@ -61,14 +115,23 @@ void timer_write(u16 address, u8 value) {
             ctx.tac = value;
             break;
     }
+
+    if (signal && !timer_signal(ctx.tac, timer_counter(now))) {
+        timer_increment();
+    }
+
+    timer_schedule();
 }
 
 // Read from timer context based on address
 u8 timer_read(u16 address) {
+    u64 now = emu_get_context()->ticks;
+
     switch (address) {
         case 0xFF04:
-            return ctx.div >> 8;
+            return (u16)timer_counter(now) >> 8;
         case 0xFF05:
+            timer_sync(now);
             return ctx.tima;
         case 0xFF06:
             return ctx.tma;
@@ -2,6 +2,7 @@
 #include <emu.h>
 #include <bus.h>
 #include <ppu.h>
+#include <tile.h>
 #include <gamepad.h>
 
 #include <SDL2/SDL.h>
@@ -47,6 +48,8 @@ void ui_init() {
                                             (16 * 8 * scale) + (16 * scale), 
                                             (32 * 8 * scale) + (64 * scale));
 
+    SDL_FillRect(debugScreen, NULL, 0xFF111111); // fill screen as a dark grey
+
     int x, y;
     SDL_GetWindowPosition(sdlWindow, &x, &y);
     SDL_SetWindowPosition(sdlDebugWindow, x + SCREEN_WIDTH + 10, y);
@@ -60,27 +63,24 @@ u32 get_ticks() {
     return SDL_GetTicks();
 }
 
-static unsigned long tile_colors[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000}; // white, light grey, dark grey, black
+static u32 tile_colors[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000}; // white, light grey, dark grey, black
 
-void display_tile(SDL_Surface *surface, u16 startLocation, u16 tileNum, int x, int y) { // display a tile
+void display_tile(SDL_Surface *surface, u16 tileNum, int x, int y) { // display a tile
     SDL_Rect rc; 
 
-    for (int tileY = 0; tileY < 16; tileY += 2) { // 16 bytes in a tile, each line represented by 2 bytes
-        u8 b1 = bus_read(startLocation + (tileNum * 16) + tileY); // byte 1
-        u8 b2 = bus_read(startLocation + (tileNum * 16) + tileY + 1); // byte 2
-
-        for (int bit = 7; bit >= 0; bit--) { // loop through each bit backwards
-            u8 hi = !!(b1 & (1 << bit)) << 1;
-            u8 lo = !!(b2 & (1 << bit));
+    for (int tileY = 0; tileY < 8; tileY++) { // 8 rows in a tile, already decoded by the PPU
+        u8 *row = ppu_get_context()->tiles.rows[tileNum * 8 + tileY];
+        u32 colors[8];
 
-            u8 color = hi | lo;
+        tile_expand_row(row, tile_colors, colors);
 
-            rc.x = x + ((7 - bit) * scale);
-            rc.y = y + (tileY / 2 * scale);
+        for (int tileX = 0; tileX < 8; tileX++) {
+            rc.x = x + (tileX * scale);
+            rc.y = y + (tileY * scale);
             rc.w = scale;
             rc.h = scale;
 
-            SDL_FillRect(surface, &rc, tile_colors[color]);
+            SDL_FillRect(surface, &rc, colors[tileX]);
         }
     }
 }
@@ -90,19 +90,24 @@ void update_dbg_window() { // display all tiles that get loaded into the OAM
     int yDraw = 0;
     int tileNum = 0;
 
-    SDL_Rect rc;
-    rc.x = 0;
-    rc.y = 0;
-    rc.w = debugScreen->w;
-    rc.h = debugScreen->h;
-    SDL_FillRect(debugScreen, &rc, 0xFF111111); // fill screen as a dark grey
+    // Only tiles written since the last update are drawn again
+    static dirty_view tiles;
 
-    u16 addr = 0x8000; // start of tile data
+    // The PPU sets the map up on the CPU thread
+    if (!dirty_ready(&ppu_get_context()->vram_dirty)) {
+        return;
+    }
+
+    if (!tiles.map) {
+        dirty_view_init(&tiles, &ppu_get_context()->vram_dirty);
+    }
 
     //384 tiles, 24 x 16
     for (int y = 0; y < 24; y++) {
         for (int x = 0; x < 16; x++) {
-            display_tile(debugScreen, addr, tileNum, xDraw + (x * scale), yDraw + (y * scale));
+            if (dirty_take(&tiles, tileNum)) {
+                display_tile(debugScreen, tileNum, xDraw + (x * scale), yDraw + (y * scale));
+            }
             xDraw += (8 * scale);
             tileNum++;
         }
@@ -156,6 +161,11 @@ void ui_on_key(bool down, u32 key_code) {
         case SDLK_DOWN: gamepad_get_state()->down = down; break;
         case SDLK_LEFT: gamepad_get_state()->left = down; break;
         case SDLK_RIGHT: gamepad_get_state()->right = down; break;
+        case SDLK_p:
+            if (down) {
+                emu_get_context()->paused = !emu_get_context()->paused;
+            }
+            break;
     }
 }
 
@@ -0,0 +1,159 @@
+#include <watch.h>
+#include <bus.h>
+#include <cpu.h>
+#include <emu.h>
+#include <jit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    watchpoint points[WATCH_MAX];
+} watch_context;
+
+static watch_context ctx;
+
+u8 watch_pages[0x100];
+
+static const char *watch_kind_name(watch_kind kind) {
+    switch (kind) {
+        case WATCH_READ: return "read";
+        case WATCH_WRITE: return "write";
+        case WATCH_EXEC: return "exec";
+    }
+
+    return "?";
+}
+
+// Hold exactly the pages some watchpoint covers
+static void watch_update() {
+    bus_release(BUS_HOLD_WATCH);
+    memset(watch_pages, 0, sizeof(watch_pages));
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchpoint *w = &ctx.points[i];
+
+        if (!w->active) {
+            continue;
+        }
+
+        for (u32 page = w->start >> 8; page <= (u32)(w->end >> 8); page++) {
+            watch_pages[page] |= w->kinds;
+            bus_hold(page << 8, 0x100, BUS_HOLD_WATCH);
+        }
+    }
+
+#if CPU_JIT
+    // Blocks already translated would run over a new execute watchpoint
+    jit_flush();
+#endif
+}
+
+int watch_add(u16 start, u16 end, u8 kinds, bool pause) {
+    if (end < start || !kinds) {
+        return -1;
+    }
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        if (!ctx.points[i].active) {
+            ctx.points[i] = (watchpoint){true, start, end, kinds, pause, 0};
+            watch_update();
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void watch_remove(int n) {
+    if (n < 0 || n >= WATCH_MAX) {
+        return;
+    }
+
+    ctx.points[n].active = false;
+    watch_update();
+}
+
+void watch_clear() {
+    memset(ctx.points, 0, sizeof(ctx.points));
+    watch_update();
+}
+
+int watch_parse(const char *spec) {
+    u8 kinds = 0;
+    bool pause = false;
+
+    for (; *spec && *spec != ':'; spec++) {
+        switch (*spec) {
+            case 'r': kinds |= WATCH_READ; break;
+            case 'w': kinds |= WATCH_WRITE; break;
+            case 'x': kinds |= WATCH_EXEC; break;
+            case 'p': pause = true; break;
+            default: return -1;
+        }
+    }
+
+    if (*spec != ':') {
+        return -1;
+    }
+
+    char *rest;
+    unsigned long start = strtoul(spec + 1, &rest, 16);
+    unsigned long end = start;
+
+    if (rest == spec + 1) {
+        return -1;
+    }
+
+    if (*rest == '-') {
+        const char *from = rest + 1;
+
+        end = strtoul(from, &rest, 16);
+
+        if (rest == from) {
+            return -1;
+        }
+    }
+
+    if (*rest || start > 0xFFFF || end > 0xFFFF) {
+        return -1;
+    }
+
+    return watch_add(start, end, kinds, pause);
+}
+
+watchpoint *watch_get(int n) {
+    if (n < 0 || n >= WATCH_MAX || !ctx.points[n].active) {
+        return NULL;
+    }
+
+    return &ctx.points[n];
+}
+
+void watch_hit(watch_kind kind, u16 address, u8 value) {
+    if (!(watch_pages[address >> 8] & kind)) {
+        return;
+    }
+
+    // Reads and writes see the PC past the accessing instruction's
+    // operands, the way the CPU has it at that point
+    u16 pc = kind == WATCH_EXEC ? address : cpu_get_regs()->pc;
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        watchpoint *w = &ctx.points[i];
+
+        if (!w->active || !(w->kinds & kind) || !BETWEEN(address, w->start, w->end)) {
+            continue;
+        }
+
+        w->hits++;
+
+        printf("Watchpoint %d: %s %04X = %02X, PC %04X, tick %llu\n", i,
+            watch_kind_name(kind), address, value, pc,
+            (unsigned long long)emu_get_context()->ticks);
+
+        if (w->pause) {
+            emu_get_context()->paused = true;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#include <tile.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    Compares the tile row kernels built in against the plain C one, first
+    for the same output over every pair of bitplane bytes, then for speed
+    decoding and expanding every pair a number of times. With --check only
+    the outputs are compared, which is what ctest runs.
+*/
+
+#define ROUNDS 200
+
+static const u32 palette[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000};
+
+static bool bench_check(const tile_kernels *ref, const tile_kernels *k) {
+    for (u32 n = 0; n < 0x10000; n++) {
+        for (int flip = 0; flip < 2; flip++) {
+            u8 want[8], got[8];
+            u32 want_pixels[8], got_pixels[8];
+
+            ref->decode_row(n & 0xFF, n >> 8, flip, want);
+            k->decode_row(n & 0xFF, n >> 8, flip, got);
+            ref->expand_row(want, palette, want_pixels);
+            k->expand_row(want, palette, got_pixels);
+
+            if (memcmp(want, got, sizeof(want)) || memcmp(want_pixels, got_pixels, sizeof(want_pixels))) {
+                printf("%s: rows %02X %02X%s differ\n", k->name, n & 0xFF, n >> 8, flip ? " flipped" : "");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static double bench_run(const tile_kernels *k, u32 *sum) {
+    clock_t start = clock();
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (u32 n = 0; n < 0x10000; n++) {
+            u8 indices[8];
+            u32 pixels[8];
+
+            k->decode_row(n & 0xFF, n >> 8, n & 1, indices);
+            k->expand_row(indices, palette, pixels);
+            *sum += pixels[n & 7];
+        }
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv) {
+    const tile_kernels *ref = tile_kernel(0);
+    double ref_time = 0;
+    u32 sum = 0;
+    int failed = 0;
+    bool check_only = argc > 1 && !strcmp(argv[1], "--check");
+
+    tile_init();
+    printf("Active kernel: %s\n", tile_active->name);
+
+    for (int n = 0; n < tile_kernel_count(); n++) {
+        const tile_kernels *k = tile_kernel(n);
+
+        if (!k) {
+            printf("kernel %d not supported by this CPU\n", n);
+            continue;
+        }
+
+        if (!bench_check(ref, k)) {
+            failed++;
+            continue;
+        }
+
+        if (check_only) {
+            printf("%-8s ok\n", k->name);
+            continue;
+        }
+
+        double time = bench_run(k, &sum);
+
+        if (!n) {
+            ref_time = time;
+        }
+
+        printf("%-8s %6.3f s, %5.2f ns/row, %4.2fx\n", k->name, time,
+            time * 1e9 / (ROUNDS * 0x10000), ref_time / time);
+    }
+
+    if (!check_only) {
+        // Keeps the rows from being optimized away
+        printf("Checksum %08X\n", sum);
+    }
+
+    return failed;
+}
@@ -1,15 +1,183 @@
 #include <check.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <emu.h>
 
 #include <cpu.h>
+#include <dirty.h>
+#include <mapper.h>
+#include <sched.h>
+#include <watch.h>
 
 START_TEST(test_nothing) {
     bool b = cpu_step();
     ck_assert_uint_eq(b, false);
 } END_TEST
 
+// A cart of rom_banks 16 KB banks, each starting with its own number
+static cart_context *test_cart(u8 type, u16 rom_banks) {
+    static cart_context cart;
+
+    free(cart.rom_data);
+    memset(&cart, 0, sizeof(cart));
+
+    cart.rom_banks = rom_banks;
+    cart.rom_size = rom_banks * 0x4000;
+    cart.rom_data = calloc(rom_banks, 0x4000);
+    cart.rom_bank_value = 1;
+    cart.mapper = mapper_for_type(type);
+
+    for (u16 bank = 0; bank < rom_banks; bank++) {
+        cart.rom_data[bank * 0x4000] = bank;
+    }
+
+    cart.mapper->map(&cart);
+
+    return &cart;
+}
+
+static void test_cart_write(cart_context *cart, u16 address, u8 value) {
+    cart->mapper->write(cart, address, value);
+    cart->mapper->map(cart);
+}
+
+// Mode 1 applies the upper bank bits to 0000-3FFF as well
+START_TEST(test_mbc1_mode_1) {
+    cart_context *cart = test_cart(0x01, 64);
+
+    test_cart_write(cart, 0x4000, 1);
+    ck_assert_uint_eq(cart->rom_bank_0[0], 0);
+    ck_assert_uint_eq(cart->rom_bank_x[0], 33);
+
+    test_cart_write(cart, 0x6000, 1);
+    ck_assert_uint_eq(cart->rom_bank_0[0], 32);
+    ck_assert_uint_eq(cart->rom_bank_x[0], 33);
+
+    // Bank 0 is still read as 1 in 4000-7FFF
+    test_cart_write(cart, 0x2000, 0);
+    ck_assert_uint_eq(cart->rom_bank_x[0], 33);
+
+    test_cart_write(cart, 0x6000, 0);
+    ck_assert_uint_eq(cart->rom_bank_0[0], 0);
+} END_TEST
+
+// Unlike MBC1, MBC5 maps bank 0 into 4000-7FFF when asked to
+START_TEST(test_mbc5_bank_0) {
+    cart_context *cart = test_cart(0x19, 4);
+
+    ck_assert_uint_eq(cart->rom_bank_x[0], 1);
+
+    test_cart_write(cart, 0x2000, 0);
+    ck_assert_uint_eq(cart->rom_bank_0[0], 0);
+    ck_assert_uint_eq(cart->rom_bank_x[0], 0);
+
+    test_cart_write(cart, 0x2000, 3);
+    ck_assert_uint_eq(cart->rom_bank_x[0], 3);
+} END_TEST
+
+// Each view sees a change once, however many other views took it first
+START_TEST(test_dirty_views) {
+    static dirty_map map;
+    static dirty_view first, second;
+    u8 changed[4];
+
+    dirty_init(&map, 1024, 8);
+    dirty_view_init(&first, &map);
+    dirty_view_init(&second, &map);
+
+    // Everything starts dirty for a new view
+    ck_assert_uint_eq(dirty_take_all(&first, changed), 4);
+    ck_assert_uint_eq(dirty_take_all(&first, changed), 0);
+
+    dirty_mark(&map, 0x210);
+    ck_assert(dirty_take(&first, 2));
+    ck_assert(!dirty_take(&first, 2));
+
+    ck_assert_uint_eq(dirty_take_all(&second, changed), 4);
+    ck_assert_uint_eq(dirty_take_all(&second, changed), 0);
+
+    dirty_mark(&map, 0x3FF);
+    ck_assert_uint_eq(dirty_take_all(&second, changed), 1);
+    ck_assert_uint_eq(changed[3], 1);
+    ck_assert(dirty_take(&first, 3));
+    ck_assert(!dirty_take(&first, 2));
+} END_TEST
+
+START_TEST(test_watch_parse_good) {
+    watch_clear();
+
+    int n = watch_parse("rwp:C000-C0FF");
+    ck_assert_int_ge(n, 0);
+
+    watchpoint *w = watch_get(n);
+    ck_assert_uint_eq(w->start, 0xC000);
+    ck_assert_uint_eq(w->end, 0xC0FF);
+    ck_assert_uint_eq(w->kinds, WATCH_READ | WATCH_WRITE);
+    ck_assert(w->pause);
+
+    n = watch_parse("x:150");
+    ck_assert_int_ge(n, 0);
+
+    w = watch_get(n);
+    ck_assert_uint_eq(w->start, 0x150);
+    ck_assert_uint_eq(w->end, 0x150);
+    ck_assert_uint_eq(w->kinds, WATCH_EXEC);
+    ck_assert(!w->pause);
+
+    watch_clear();
+} END_TEST
+
+START_TEST(test_watch_parse_bad) {
+    static const char *specs[] = {
+        "", "C000", "r", "r:", ":C000", "q:C000", "rC000", "r:C000-",
+        "r:C000x", "r:C0FF-C000", "r:10000", "r:10000-FFFF", "r:C000-10000",
+    };
+
+    watch_clear();
+
+    for (int i = 0; i < (int)(sizeof(specs) / sizeof(specs[0])); i++) {
+        ck_assert_msg(watch_parse(specs[i]) < 0, "accepted \"%s\"", specs[i]);
+    }
+
+    for (int i = 0; i < WATCH_MAX; i++) {
+        ck_assert(!watch_get(i));
+    }
+} END_TEST
+
+// The earliest pending tick is at the top of the heap through schedules,
+// reschedules and cancels from any position
+START_TEST(test_sched_order) {
+    sched_init();
+    ck_assert_uint_eq(sched_next_tick, UINT64_MAX);
+
+    sched_schedule(EV_SERIAL, 300);
+    sched_schedule(EV_TIMER, 100);
+    sched_schedule(EV_DMA, 200);
+    sched_schedule(EV_PPU, 50);
+    ck_assert_uint_eq(sched_next_tick, 50);
+
+    sched_cancel(EV_PPU);
+    ck_assert_uint_eq(sched_next_tick, 100);
+
+    sched_schedule(EV_TIMER, 400);
+    ck_assert_uint_eq(sched_next_tick, 200);
+
+    sched_cancel(EV_SERIAL);
+    sched_cancel(EV_SERIAL);
+    ck_assert_uint_eq(sched_next_tick, 200);
+
+    sched_schedule(EV_PPU, 10);
+    ck_assert_uint_eq(sched_next_tick, 10);
+
+    sched_cancel(EV_PPU);
+    sched_cancel(EV_DMA);
+    ck_assert_uint_eq(sched_next_tick, 400);
+
+    sched_cancel(EV_TIMER);
+    ck_assert_uint_eq(sched_next_tick, UINT64_MAX);
+} END_TEST
+
 Suite *stack_suite() {
     Suite *s = suite_create("emu");
     TCase *tc = tcase_create("core");
@@ -17,6 +185,24 @@ Suite *stack_suite() {
     tcase_add_test(tc, test_nothing);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("mapper");
+    tcase_add_test(tc, test_mbc1_mode_1);
+    tcase_add_test(tc, test_mbc5_bank_0);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("dirty");
+    tcase_add_test(tc, test_dirty_views);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("watch");
+    tcase_add_test(tc, test_watch_parse_good);
+    tcase_add_test(tc, test_watch_parse_bad);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("sched");
+    tcase_add_test(tc, test_sched_order);
+    suite_add_tcase(s, tc);
+
     return s;
 }
 